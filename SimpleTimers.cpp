@@ -47,42 +47,271 @@
 #ifndef SIMPLETIMERS_cpp
 #define SIMPLETIMERS_cpp
 
+#include <math.h>
 #include "SimpleTimers.h"
 
 
 //Global ISR function array
 volatile static voidFuncPtr intFunc[5];
 
+//Interrupt enable/flag bits, indexed by the timer that owns the interrupt (TIMER1-TIMER5)
+static const uint32_t timerIEMask[5] = {_IEC0_T1IE_MASK, _IEC0_T2IE_MASK, _IEC0_T3IE_MASK, _IEC0_T4IE_MASK, _IEC0_T5IE_MASK};
+static const uint32_t timerIFMask[5] = {_IFS0_T1IF_MASK, _IFS0_T2IF_MASK, _IFS0_T3IF_MASK, _IFS0_T4IF_MASK, _IFS0_T5IF_MASK};
+
+//Hardware event counter state, indexed by interrupt slot
+static volatile uint64_t cntBase[5];		//Counts already folded in by the counter ISR
+static volatile uint32_t cntPeriod[5];		//PRx value of the period in progress
+#define CNT_MIN_PERIOD	256					//Shortest period the counter ISR restores PRx within, in timer counts
+static volatile uint32_t cntSeq[5];			//Bumped by the counter ISR so readers can spot a torn read
+static volatile uint64_t cntThreshold[5];
+static volatile voidFuncPtr cntFunc[5];		//Threshold callback, 0 when disarmed
+static uint8_t cntMode[5];
+static uint8_t cntTimer[5];					//Timer (TIMER1-TIMER45) running as a counter in this slot
+
+//Extended period state, indexed by interrupt slot. Each period is extPhases hardware periods:
+//the first extExtra of them are extTicks+1 ticks long, the rest extTicks.
+static volatile uint32_t extPhase[5];
+static uint32_t extPhases[5];
+static uint32_t extTicks[5];
+static uint32_t extExtra[5];
+static volatile voidFuncPtr extFunc[5];
+static uint8_t extTimer[5];
+
+//Timer group state, indexed by timer <TIMER1-TIMER45>. prepareTimer() sets groupTicks so the next startTimerGroup()
+//can make up for the timer being turned on after others in the set; it's cleared once that's done.
+static uint16_t groupPrescale[7];
+static uint32_t groupTicks[7];
+static uint32_t groupGap4;					//CPU cycles across four of startTimerGroup()'s TxCONSET stores
+static bool groupMeasured;
+static const uint8_t groupStore[7] = {0, 1, 2, 3, 4, 1, 3};	//Position of each timer's store in the sequence
+
+//Stepper axis state, indexed by timer (TIMER2 = 0, TIMER3 = 1). Step periods are in timer ticks, fixed point with
+//STEP_FRAC fraction bits. stepW is the squared speed in units of 1/STEP_DELTA_MAX of a full acceleration step.
+#define STEP_FRAC		8
+#define STEP_DELTA_MAX	16
+#define STEP_W_MAX		900000000UL		//So 4*stepW + delta plus the carried remainder fits in 32 bits
+#define STEP_IDLE		0
+#define STEP_ACCEL		1
+#define STEP_CRUISE		2
+#define STEP_DECEL		3
+
+static uint8_t stepOC[2];
+static uint8_t stepDirPin[2];
+static uint8_t stepProfile[2];
+static volatile uint8_t stepPhase[2];
+static volatile long stepPosition[2];
+static volatile uint32_t stepRemaining[2];
+static int8_t stepDir[2];
+static uint32_t stepAccelSteps[2];			//Steps spent accelerating, and so needed to decelerate
+static uint32_t stepPeriod[2];				//Current period
+static uint32_t stepMinPeriod[2];			//Period at full speed
+static uint32_t stepW[2];
+static uint32_t stepWTop[2];				//stepW at full speed
+static uint32_t stepRem[2];					//Remainder of the last period division, carried into the next
+static uint32_t stepTail[2];				//S-curve: steps taken at the smallest delta after easing out
+static uint32_t stepPeak[2];				//Last accelerating period before clamping to stepMinPeriod
+static uint32_t stepWTaper[2];				//S-curve: stepW where acceleration starts easing out
+static uint32_t stepRamp[2];				//S-curve: position on the acceleration ramp, 0 to stepJerk
+static uint32_t stepJerk[2];				//S-curve: steps to ramp acceleration fully in or out
+static uint32_t stepPulse[2];				//Pulse width, ticks
+
+//Cyclic executive state. The tasks run in minor frame f are execSlots[execFrameStart[f]] up to
+//execSlots[execFrameStart[f+1]], as indexes into execTasks.
+static const ExecTask *execTasks;
+static uint8_t execTimer = 0xFF;
+static uint8_t execFrames;
+static volatile uint8_t execFrame;
+static uint8_t execFrameStart[EXEC_MAX_FRAMES+1];
+static uint8_t execSlots[EXEC_MAX_SLOTS];
+static uint8_t execTaskGroup[EXEC_MAX_TASKS];
+static uint8_t execGroups;
+static uint16_t execGroupRate[EXEC_MAX_GROUPS];
+static volatile uint32_t execGroupOverruns[EXEC_MAX_GROUPS];
+static volatile uint32_t execGroupWorst[EXEC_MAX_GROUPS];		//CPU cycles
+
+//TIMERCORE state. The core timer is shared with millis(), so it is driven through the core's timer service list
+//instead of owning the vector. coreRunning is written last when starting and first when stopping, so the service
+//never sees half of an update.
+static volatile uint32_t coreNext;			//Count value of the next event
+static volatile uint32_t corePeriod;		//Core timer ticks, 0 for one-shot
+static uint32_t coreDelay;					//Ticks last started with, so timerReset() can restart either kind
+static volatile voidFuncPtr coreFunc;
+static volatile bool coreRunning;
+static volatile bool coreEnabled;
+static bool coreServiceAttached;
+
+/* --------------------------------------------------------------------------------------------------------------------------------------- */
+/*	Local helpers shared by the counter, indexed by timer <TIMER1, TIMER2, TIMER3, TIMER4, TIMER5, TIMER23, TIMER45>
+*/
+
+//The timer whose interrupt fires for timerNum. 32 bit pairs interrupt on the odd timer.
+static uint8_t timerSlot(uint8_t timerNum){
+	if (timerNum==TIMER23) return TIMER3;
+	if (timerNum==TIMER45) return TIMER5;
+	return timerNum;
+}
+
+static uint32_t timerMaxPeriod(uint8_t timerNum){
+	return (timerNum==TIMER23 || timerNum==TIMER45) ? 0xFFFFFFFF : MAX16BIT-1;
+}
+
+static uint32_t timerCount(uint8_t timerNum){
+	switch(timerNum){
+		case TIMER1: return TMR1;
+		case TIMER2: return TMR2;
+		case TIMER3: return TMR3;
+		case TIMER4: return TMR4;
+		case TIMER5: return TMR5;
+		case TIMER23: return TMR2;	//TMR2 holds all 32 bits in 32 bit mode
+		case TIMER45: return TMR4;
+	}
+	return 0;
+}
+
+static void timerSetCount(uint8_t timerNum, uint32_t count){
+	switch(timerNum){
+		case TIMER1: TMR1=count; break;
+		case TIMER2: TMR2=count; break;
+		case TIMER3: TMR3=count; break;
+		case TIMER4: TMR4=count; break;
+		case TIMER5: TMR5=count; break;
+		case TIMER23: TMR2=count; break;
+		case TIMER45: TMR4=count; break;
+	}
+}
+
+static void timerSetPR(uint8_t timerNum, uint32_t period){
+	switch(timerNum){
+		case TIMER1: PR1=period; break;
+		case TIMER2: PR2=period; break;
+		case TIMER3: PR3=period; break;
+		case TIMER4: PR4=period; break;
+		case TIMER5: PR5=period; break;
+		case TIMER23: PR2=period; break;
+		case TIMER45: PR4=period; break;
+	}
+}
+
+//Writes TxCON with the timer off, adding T32 for the pairs
+static void timerWriteCon(uint8_t timerNum, uint32_t con){
+	con &= ~T_ON;
+	switch(timerNum){
+		case TIMER1: T1CON=con; break;
+		case TIMER2: T2CON=con; break;
+		case TIMER3: T3CON=con; break;
+		case TIMER4: T4CON=con; break;
+		case TIMER5: T5CON=con; break;
+		case TIMER23: T3CON=0x0, T2CON=(con | T_32_BIT_MODE_ON); break;
+		case TIMER45: T5CON=0x0, T4CON=(con | T_32_BIT_MODE_ON); break;
+	}
+}
+
+static void timerOn(uint8_t timerNum){
+	switch(timerNum){
+		case TIMER1: T1CONSET=T_ON; break;
+		case TIMER2: case TIMER23: T2CONSET=T_ON; break;
+		case TIMER3: T3CONSET=T_ON; break;
+		case TIMER4: case TIMER45: T4CONSET=T_ON; break;
+		case TIMER5: T5CONSET=T_ON; break;
+	}
+}
+
+static void timerOff(uint8_t timerNum){
+	switch(timerNum){
+		case TIMER1: T1CONCLR=T_ON; break;
+		case TIMER2: case TIMER23: T2CONCLR=T_ON; break;
+		case TIMER3: T3CONCLR=T_ON; break;
+		case TIMER4: case TIMER45: T4CONCLR=T_ON; break;
+		case TIMER5: T5CONCLR=T_ON; break;
+	}
+}
+
+//TCKPS bits for a prescale ratio, rounding up to the next ratio the timer supports.
+//Timer1 only has 1, 8, 64 and 256; the others add 2, 4, 16 and 32.
+static uint32_t prescaleBits(uint8_t timerNum, uint16_t prescale){
+	if (timerNum==TIMER1){
+		if (prescale<=1)	return T1_PS_1_1;
+		if (prescale<=8)	return T1_PS_1_8;
+		if (prescale<=64)	return T1_PS_1_64;
+		return T1_PS_1_256;
+	}
+	if (prescale<=1)	return PS_1_1;
+	if (prescale<=2)	return PS_1_2;
+	if (prescale<=4)	return PS_1_4;
+	if (prescale<=8)	return PS_1_8;
+	if (prescale<=16)	return PS_1_16;
+	if (prescale<=32)	return PS_1_32;
+	if (prescale<=64)	return PS_1_64;
+	return PS_1_256;
+}
+
+/* --------------------------------------------------------------------------------------------------------------------------------------- */
+//TIMERCORE service, called by the core timer ISR with the current Count. Returns the Count it next wants to run at.
+//The next event is always the last one plus the period, so the period never drifts with interrupt latency.
+static uint32_t coreTimerService(uint32_t now){
+
+	voidFuncPtr func;
+
+	if (!coreRunning) return now + 0x40000000;		//Idle, nothing to do for a long while
+	if ((int32_t)(now - coreNext) < 0) return coreNext;	//Called for another service
+
+	func = coreFunc;
+	if (corePeriod == 0) coreRunning = false;
+	else{
+		do coreNext += corePeriod;					//Skip periods already missed, keeping the phase
+		while ((int32_t)(now - coreNext) >= 0);
+	}
+	if (func != 0 && coreEnabled) (*func)();
+	return coreRunning ? coreNext : now + 0x40000000;
+}
+
+static void coreTimerStart(uint32_t ticks, bool oneShot){
+	if (ticks == 0) ticks = 1;
+	coreRunning = false;
+	coreDelay = ticks;
+	corePeriod = oneShot ? 0 : ticks;
+	coreNext = _CP0_GET_COUNT() + ticks;
+	coreRunning = true;
+	if (!coreServiceAttached) coreServiceAttached = attachCoreTimerService(coreTimerService);
+	callCoreTimerServiceNow(coreTimerService);		//Reprogram Compare in case this event is the soonest
+}
+
 /* --------------------------------------------------------------------------------------------------------------------------------------- */
 /*	startTimer()
 **
 **	Parameters:
-**		timerNum:	The timer to initialize <TIMER1, TIMER2, TIMER3, TIMER4, TIMER5, TIMER23, TIMER45> 
+**		timerNum:	The timer to initialize <TIMER1, TIMER2, TIMER3, TIMER4, TIMER5, TIMER23, TIMER45, TIMERCORE> 
 **		microseconds:	The period, in microseconds, to set the timer to.
 **
 **	Return Value:
 **		none
 **
 **	Errors:
-**		none
+**		Periods longer than the timer can reach at /256 are clamped to its maximum period. Use
+**		startTimerExtended() for longer periods.
 **
 **  Description:
 **		Starts the specified timer with a period specified by the user in microseconds.
+**		TIMERCORE runs from the CP0 core timer at F_CPU/2, up to 2^31 ticks (about 53 s at 80 MHz).
 **
 **	Example:
 **		startTimer(TIMER23, 10000000);	Starts a 32 bit timer (TIMER2 & TIMER3) with a period of 10 seconds
 */
 void startTimer(uint8_t timerNum, long microseconds){
 
-	unsigned long cycles = (F_CPU / 1000000) * microseconds;	//Number of cycles = Cycles per second * Seconds
+	uint64_t cycles = (uint64_t)(F_CPU / 1000000) * microseconds;	//Number of cycles = Cycles per second * Seconds
+	if (timerNum == TIMERCORE){
+		coreTimerStart(cycles / 2 > 0x7FFFFFFF ? 0x7FFFFFFF : cycles / 2, false);
+		return;
+	}
 	if (timerNum < 7){
 		switch (timerNum){
 			case(TIMER1):
-				if(cycles < MAX16BIT)              T1CON=(~T_ON & PS_1_1), PR1=cycles-1, T1CONSET=T_ON;  	// No prescale
-				else if((cycles >>= 3) < MAX16BIT) T1CON=(~T_ON & PS_1_8), PR1=cycles-1, T1CONSET=T_ON;      	// Prescale by /8 
-				else if((cycles >>= 3) < MAX16BIT) T1CON=(~T_ON & PS_1_64), PR1=cycles-1, T1CONSET=T_ON;   	// Prescale by /64
-				else if((cycles >>= 2) < MAX16BIT) T1CON=(~T_ON & PS_1_256), PR1=cycles-1, T1CONSET=T_ON; 	// Prescale by /256
-				else        					   T1CON=(~T_ON &  PS_1_256), PR1=MAX16BIT-1, T1CONSET=T_ON; 				// Max period
+				if(cycles < MAX16BIT)              T1CON=(~T_ON & T1_PS_1_1), PR1=cycles-1, T1CONSET=T_ON;  	// No prescale
+				else if((cycles >>= 3) < MAX16BIT) T1CON=(~T_ON & T1_PS_1_8), PR1=cycles-1, T1CONSET=T_ON;      	// Prescale by /8 
+				else if((cycles >>= 3) < MAX16BIT) T1CON=(~T_ON & T1_PS_1_64), PR1=cycles-1, T1CONSET=T_ON;   	// Prescale by /64
+				else if((cycles >>= 2) < MAX16BIT) T1CON=(~T_ON & T1_PS_1_256), PR1=cycles-1, T1CONSET=T_ON; 	// Prescale by /256
+				else        					   T1CON=(~T_ON &  T1_PS_1_256), PR1=MAX16BIT-1, T1CONSET=T_ON; 				// Max period
 				break;
 			case(TIMER2):
 				if(cycles < MAX16BIT)              T2CON=(~T_ON & PS_1_1), PR2=cycles-1, T2CONSET=T_ON;   	// No prescale
@@ -113,20 +342,104 @@ void startTimer(uint8_t timerNum, long microseconds){
 				else        					  T5CON=(~T_ON & PS_1_256), PR5=MAX16BIT-1, T5CONSET=T_ON; 	// Max period
 				break;
 			case(TIMER23):
-				if(cycles < MAX32BIT)				T2CON=(~T_ON & T_32_BIT_MODE_ON | PS_1_1), PR2=cycles-1, T2CONSET=T_ON;	//No prescale
-				else if((cycles >>= 3) < MAX32BIT)	T2CON=(~T_ON & T_32_BIT_MODE_ON | PS_1_8), PR2=cycles-1, T2CONSET=T_ON;  	//Prescale by /8
-				else if((cycles >>= 3) < MAX32BIT)	T2CON=(~T_ON & T_32_BIT_MODE_ON | PS_1_64), PR2=cycles-1, T2CONSET=T_ON; 	//Prescale by /64
-				else if((cycles >>= 2) < MAX32BIT)	T2CON=(~T_ON & T_32_BIT_MODE_ON | PS_1_256), PR2=cycles-1, T2CONSET=T_ON;	//Prescale by /256
-				else								T2CON=(~T_ON & T_32_BIT_MODE_ON | PS_1_256), PR2=MAX16BIT-1, T2CONSET=T_ON;	//Max period possible
+				if(cycles < MAX32BIT)				T2CON=(T_32_BIT_MODE_ON | PS_1_1), PR2=cycles-1, T2CONSET=T_ON;	//No prescale
+				else if((cycles >>= 3) < MAX32BIT)	T2CON=(T_32_BIT_MODE_ON | PS_1_8), PR2=cycles-1, T2CONSET=T_ON;  	//Prescale by /8
+				else if((cycles >>= 3) < MAX32BIT)	T2CON=(T_32_BIT_MODE_ON | PS_1_64), PR2=cycles-1, T2CONSET=T_ON; 	//Prescale by /64
+				else if((cycles >>= 2) < MAX32BIT)	T2CON=(T_32_BIT_MODE_ON | PS_1_256), PR2=cycles-1, T2CONSET=T_ON;	//Prescale by /256
+				else								T2CON=(T_32_BIT_MODE_ON | PS_1_256), PR2=MAX32BIT-1, T2CONSET=T_ON;	//Max period possible
 				break;
 			case(TIMER45):
-				if(cycles < MAX32BIT)				T4CON=(~T_ON &  T_32_BIT_MODE_ON | PS_1_1), PR4=cycles-1, T4CONSET=T_ON;	//No prescale
-				else if((cycles >>= 3) < MAX32BIT)	T2CON=(~T_ON &  T_32_BIT_MODE_ON | PS_1_8), PR4=cycles-1, T4CONSET=T_ON;  	//Prescale by /8
-				else if((cycles >>= 3) < MAX32BIT)	T2CON=(~T_ON &  T_32_BIT_MODE_ON | PS_1_64), PR4=cycles-1, T4CONSET=T_ON; 	//Prescale by /64
-				else if((cycles >>= 2) < MAX32BIT)	T2CON=(~T_ON &  T_32_BIT_MODE_ON | PS_1_256), PR4=cycles-1, T4CONSET=T_ON;	//Prescale by /256
-				else								T2CON=(~T_ON &  T_32_BIT_MODE_ON | PS_1_256), PR4=MAX16BIT-1, T4CONSET=T_ON;	//Max period possible
+				if(cycles < MAX32BIT)				T4CON=(T_32_BIT_MODE_ON | PS_1_1), PR4=cycles-1, T4CONSET=T_ON;	//No prescale
+				else if((cycles >>= 3) < MAX32BIT)	T4CON=(T_32_BIT_MODE_ON | PS_1_8), PR4=cycles-1, T4CONSET=T_ON;  	//Prescale by /8
+				else if((cycles >>= 3) < MAX32BIT)	T4CON=(T_32_BIT_MODE_ON | PS_1_64), PR4=cycles-1, T4CONSET=T_ON; 	//Prescale by /64
+				else if((cycles >>= 2) < MAX32BIT)	T4CON=(T_32_BIT_MODE_ON | PS_1_256), PR4=cycles-1, T4CONSET=T_ON;	//Prescale by /256
+				else								T4CON=(T_32_BIT_MODE_ON | PS_1_256), PR4=MAX32BIT-1, T4CONSET=T_ON;	//Max period possible
+				break;
+		}
+	}
+}
+
+/* --------------------------------------------------------------------------------------------------------------------------------------- */
+//Extended period ISR, attached through intFunc[] by startTimerExtended(). Runs at the start of each hardware
+//period, so PRx is loaded for the period that is now counting.
+static void extendedISR(uint8_t slot){
+	uint32_t phase = extPhase[slot] + 1;
+
+	if (phase == extPhases[slot]) phase = 0;
+	extPhase[slot] = phase;
+	timerSetPR(extTimer[slot], extTicks[slot] - (phase < extExtra[slot] ? 0 : 1));
+	if (phase == 0 && extFunc[slot] != 0) (*extFunc[slot])();
+}
+
+static void extendedISR1(void){ extendedISR(TIMER1); }
+static void extendedISR2(void){ extendedISR(TIMER2); }
+static void extendedISR3(void){ extendedISR(TIMER3); }
+static void extendedISR4(void){ extendedISR(TIMER4); }
+static void extendedISR5(void){ extendedISR(TIMER5); }
+
+static const voidFuncPtr extendedISRs[5] = {extendedISR1, extendedISR2, extendedISR3, extendedISR4, extendedISR5};
+
+/* --------------------------------------------------------------------------------------------------------------------------------------- */
+/*	startTimerExtended()
+**
+**	Parameters:
+**		timerNum:		The timer to use <TIMER1, TIMER2, TIMER3, TIMER4, TIMER5, TIMER23, TIMER45>
+**		microseconds:	The period, in microseconds
+**		userFunc:		The function to call once every period
+**
+**	Return Value:
+**		none
+**
+**	Errors:
+**		none
+**
+**  Description:
+**		Calls userFunc periodically with a period longer than the timer can reach on its own, exact to the cycle.
+**		The period is split into N hardware periods that add up to exactly the requested number of cycles. The
+**		split is spread evenly (every hardware period is either T or T+1 ticks), so PRx is never reloaded
+**		with a value small enough to be missed. The whole period always adds up to the same number of cycles, so
+**		there is no drift. The largest prescaler that divides the period evenly is used, to keep the interrupt rate down.
+**
+**		This uses the timer's interrupt, so don't attach another function to it. Stop it with stopTimer().
+**
+**	Example:
+**		startTimerExtended(TIMER23, 3600000000ULL, everyHour);	Calls everyHour() once an hour
+*/
+void startTimerExtended(uint8_t timerNum, uint64_t microseconds, void (*userFunc)(void)){
+
+	static const uint16_t prescales[] = {256, 64, 32, 16, 8, 4, 2, 1};
+	static const uint16_t t1Prescales[] = {256, 64, 8, 1};
+	const uint16_t *ratios = (timerNum==TIMER1) ? t1Prescales : prescales;
+	uint8_t numRatios = (timerNum==TIMER1) ? 4 : 8;
+	uint64_t cycles = (uint64_t)(F_CPU / 1000000) * microseconds;
+	uint64_t ticks;
+	uint16_t prescale = 1;
+	uint8_t slot, i;
+
+	if (timerNum < 7 && cycles >= 2){
+		slot = timerSlot(timerNum);
+		for (i = 0; i < numRatios; i++){
+			if (cycles % ratios[i] == 0 && cycles / ratios[i] >= 2){
+				prescale = ratios[i];
 				break;
+			}
 		}
+		ticks = cycles / prescale;
+
+		stopTimer(timerNum);
+		IFS0CLR = timerIFMask[slot];
+		extPhases[slot] = (ticks + timerMaxPeriod(timerNum)) / ((uint64_t)timerMaxPeriod(timerNum) + 1);	//Round up
+		extTicks[slot] = ticks / extPhases[slot];
+		extExtra[slot] = ticks % extPhases[slot];
+		extPhase[slot] = 0;
+		extFunc[slot] = userFunc;
+		extTimer[slot] = timerNum;
+
+		timerWriteCon(timerNum, prescaleBits(timerNum, prescale));
+		timerSetCount(timerNum, 0);
+		timerSetPR(timerNum, extTicks[slot] - (extExtra[slot] ? 0 : 1));
+		attachTimerInterrupt(timerNum, extendedISRs[slot]);
+		timerOn(timerNum);
 	}
 }
 
@@ -134,7 +447,7 @@ void startTimer(uint8_t timerNum, long microseconds){
 /*	stopTimer()
 **
 **	Parameters:
-**		timerNum:	The timer to stop <TIMER1, TIMER2, TIMER3, TIMER4, TIMER5, TIMER23, TIMER45> 
+**		timerNum:	The timer to stop <TIMER1, TIMER2, TIMER3, TIMER4, TIMER5, TIMER23, TIMER45, TIMERCORE> 
 **
 **	Return Value:
 **		none
@@ -143,12 +456,13 @@ void startTimer(uint8_t timerNum, long microseconds){
 **		none
 **
 **  Description:
-**		Stops the specified timer
+**		Stops the specified timer and clears its pending interrupt, so it doesn't fire when the timer is restarted
 **
 **	Example:
 **		stopTimer(TIMER23)	Stops the 32 bit timer (TIMER2 & TIMER3)
 */
 void stopTimer(uint8_t timerNum){
+	if (timerNum == TIMERCORE) coreRunning = false;
 	if (timerNum < 7){
 		switch(timerNum){
 			case TIMER1:IEC0CLR = _IEC0_T1IE_MASK, T1CON = 0x0;
@@ -166,6 +480,7 @@ void stopTimer(uint8_t timerNum){
 			case TIMER45:IEC0CLR = _IEC0_T5IE_MASK, T4CON = 0x0, T5CON = 0x0;
 				break;
 		}
+		IFS0CLR = timerIFMask[timerSlot(timerNum)];
 	}
 }
 
@@ -173,7 +488,7 @@ void stopTimer(uint8_t timerNum){
 /*	setTimerPeriod()
 **
 **	Parameters:
-**		timerNum:	The timer to set the period of <TIMER1, TIMER2, TIMER3, TIMER4, TIMER5, TIMER23, TIMER45> 
+**		timerNum:	The timer to set the period of <TIMER1, TIMER2, TIMER3, TIMER4, TIMER5, TIMER23, TIMER45, TIMERCORE> 
 **
 **	Return Value:
 **		none
@@ -196,7 +511,7 @@ void setTimerPeriod(uint8_t timerNum, long microseconds){
 /*	timerReset()
 **
 **	Parameters:
-**		timerNum:	The timer to reset <TIMER1, TIMER2, TIMER3, TIMER4, TIMER5, TIMER23, TIMER45> 
+**		timerNum:	The timer to reset <TIMER1, TIMER2, TIMER3, TIMER4, TIMER5, TIMER23, TIMER45, TIMERCORE> 
 **
 **	Return Value:
 **		none
@@ -205,13 +520,16 @@ void setTimerPeriod(uint8_t timerNum, long microseconds){
 **		none
 **
 **  Description:
-**		Resets the value of the timer counter to 0.
+**		Resets the value of the timer counter to 0. The core timer's Count is shared, so for TIMERCORE the
+**		current period, or a pending one-shot's full delay, restarts from now instead.
 **
 **	Example:
 **		timerReset(TIMER23);	Resets the 32 bit timer 2-3 count to 0.
 */
 void timerReset(uint8_t timerNum){
 	switch(timerNum){
+		case TIMERCORE: if (coreRunning) coreTimerStart(coreDelay, corePeriod == 0);
+			break;
 		case TIMER1: TMR1=0;
 			break;
 		case TIMER2: TMR2=0;
@@ -229,99 +547,285 @@ void timerReset(uint8_t timerNum){
 	}
 }
 /* --------------------------------------------------------------------------------------------------------------------------------------- */
-/*	attachTimerInterrupt()
+/*	startTimerOneShot()
 **
 **	Parameters:
-**		timerNum:	The timer interrupt to set <TIMER1, TIMER2, TIMER3, TIMER4, TIMER5, TIMER23, TIMER45> 
-**		userfunc:	The interrupt service routine to jump to when the interrupt is triggered
+**		timerNum:		The timer to use <TIMERCORE>
+**		microseconds:	The delay, in microseconds, up to 2^31 core timer ticks (about 53 s at 80 MHz)
 **
 **	Return Value:
 **		none
 **
 **	Errors:
+**		Only TIMERCORE supports one-shot events. Other timers are ignored.
+**
+**  Description:
+**		Calls the function attached to the timer once, after the delay. Starting another one-shot or a periodic
+**		timer before it fires replaces it.
+**
+**	Example:
+**		attachTimerInterrupt(TIMERCORE, endOfPulse);
+**		startTimerOneShot(TIMERCORE, 250);	Calls endOfPulse() once, 250 us from now
+*/
+void startTimerOneShot(uint8_t timerNum, long microseconds){
+
+	uint64_t ticks = (uint64_t)(F_CPU / 2000000) * microseconds;	//Core timer runs at half the CPU clock
+
+	if (timerNum == TIMERCORE) coreTimerStart(ticks > 0x7FFFFFFF ? 0x7FFFFFFF : ticks, true);
+}
+
+/* --------------------------------------------------------------------------------------------------------------------------------------- */
+/*	coreCycles()
+**
+**	Parameters:
+**		none
+**
+**	Return Value:
+**		The CPU cycle count, wrapping every 2^32 cycles
+**
+**	Errors:
 **		none
 **
 **  Description:
-**		Specifies a function as an interrupt service routine for a timer.
+**		Reads the CP0 Count register, which is inside the CPU core, so unlike TMRx there is no peripheral bus access.
+**		Count ticks every 2 cycles, so the result is always even. Differences are correct across the wrap as long
+**		as they are computed in 32 bits.
 **
 **	Example:
-**		attachTimerInterrupt(TIMER23, toggleLED);	Attaches the 32 bit timer 2-3 to the function toggleLED();
+**		uint32_t start = coreCycles(); work(); uint32_t took = coreCycles() - start;
 */
-void attachTimerInterrupt(uint8_t timerNum, void (*userFunc)(void))
-{
-    if (timerNum < 7)
-    {
-		if (timerNum==TIMER23)	timerNum=TIMER3;
-		else if (timerNum==TIMER45)	timerNum=TIMER5;
-		
-        intFunc[timerNum]	=	userFunc;
+uint32_t coreCycles(void){
+	return _CP0_GET_COUNT() << 1;
+}
+
+/* --------------------------------------------------------------------------------------------------------------------------------------- */
+/*	prepareTimer()
+**
+**	Parameters:
+**		timerNum:		The timer to set up <TIMER1, TIMER2, TIMER3, TIMER4, TIMER5, TIMER23, TIMER45>
+**		microseconds:	The period, in microseconds
+**		phase:			How far into its period, in microseconds, the timer starts
+**
+**	Return Value:
+**		none
+**
+**	Errors:
+**		Periods longer than the timer can reach at /256 are clamped to its maximum period.
+**
+**  Description:
+**		Loads TxCON, PRx and TMRx for a timer but leaves it off, so it can be started together with others by
+**		startTimerGroup(). The phase is taken modulo the period. The timer's interrupt settings are not touched,
+**		so it can be attached before or after.
+**
+**	Example:
+**		prepareTimer(TIMER3, 1000, 250);	1 ms period, starting a quarter period ahead
+*/
+void prepareTimer(uint8_t timerNum, long microseconds, long phase){
+
+	static const uint16_t prescales[] = {1, 8, 64, 256};
+	uint64_t cycles = (uint64_t)(F_CPU / 1000000) * microseconds;
+	uint64_t offset = (uint64_t)(F_CPU / 1000000) * phase;
+	uint64_t ticks = cycles;
+	uint16_t prescale = 1;
+	uint8_t i;
+
+	if (timerNum < 7 && cycles > 0){
+		for (i = 0; i < 4; i++){
+			prescale = prescales[i];
+			ticks = cycles / prescale;
+			if (ticks <= (uint64_t)timerMaxPeriod(timerNum) + 1) break;
+		}
+		if (ticks > (uint64_t)timerMaxPeriod(timerNum) + 1) ticks = (uint64_t)timerMaxPeriod(timerNum) + 1;
 
+		timerWriteCon(timerNum, prescaleBits(timerNum, prescale));
+		timerSetPR(timerNum, ticks-1);
+		timerSetCount(timerNum, (offset / prescale) % ticks);
+		groupPrescale[timerNum] = prescale;
+		groupTicks[timerNum] = ticks;
+	}
+}
+
+/* --------------------------------------------------------------------------------------------------------------------------------------- */
+/*	startTimerGroup()
+**
+**	Parameters:
+**		timers:	The timers to start, OR'd together <TIMER_BIT(TIMER1) ... TIMER_BIT(TIMER45)>
+**
+**	Return Value:
+**		The skew in CPU cycles between the first and the last timer of the set being turned on, 0 for a single timer
+**
+**	Errors:
+**		none
+**
+**  Description:
+**		Turns on a set of timers set up with prepareTimer() with the smallest possible skew. The ON bits are worked
+**		out beforehand, then written with interrupts off as five back to back TxCONSET stores in a fixed order
+**		(T1, T2 or T23, T3, T4 or T45, T5). Timers not in the set get a store of 0, which does nothing, so the
+**		sequence has no branches and the gap between any two stores is the same every time. The gap is measured
+**		with the core timer on the first call, by timing the sequence with all stores 0.
+**
+**		The first time a timer is started after prepareTimer(), its count is advanced by the gap times the number
+**		of stores since the first timer of the set, to the nearest tick, so the phases come out as prepared. When
+**		stopTimerGroup() freezes the same set, the stop skew cancels the start skew, so resuming needs no correction.
+**
+**	Example:
+**		prepareTimer(TIMER2, 1000, 0);
+**		prepareTimer(TIMER3, 1000, 500);
+**		startTimerGroup(TIMER_BIT(TIMER2) | TIMER_BIT(TIMER3));	Two 1 kHz timebases, half a period apart
+*/
+
+//Times the store sequence of startTimerGroup() with stores of 0, which change nothing, against a single store.
+//T5CON is read back after each, since peripheral bus stores are posted. The second pass runs from the cache.
+static void groupMeasure(void){
+
+	uint32_t status, start, mid, end;
+	uint8_t pass;
+
+	for (pass = 0; pass < 2; pass++){
+		status = disableInterrupts();
+		start = _CP0_GET_COUNT();
+		T1CONSET = 0;
+		T2CONSET = 0;
+		T3CONSET = 0;
+		T4CONSET = 0;
+		T5CONSET = 0;
+		(void) T5CON;
+		mid = _CP0_GET_COUNT();
+		T5CONSET = 0;
+		(void) T5CON;
+		end = _CP0_GET_COUNT();
+		restoreInterrupts(status);
+	}
+	groupGap4 = (mid - start > end - mid) ? ((mid - start) - (end - mid)) * 2 : 0;	//Core timer counts at half the CPU clock
+	groupMeasured = true;
+}
+
+uint32_t startTimerGroup(uint8_t timers){
+
+	uint32_t on1 = (timers & TIMER_BIT(TIMER1)) ? T_ON : 0;
+	uint32_t on2 = (timers & (TIMER_BIT(TIMER2) | TIMER_BIT(TIMER23))) ? T_ON : 0;
+	uint32_t on3 = (timers & TIMER_BIT(TIMER3)) ? T_ON : 0;
+	uint32_t on4 = (timers & (TIMER_BIT(TIMER4) | TIMER_BIT(TIMER45))) ? T_ON : 0;
+	uint32_t on5 = (timers & TIMER_BIT(TIMER5)) ? T_ON : 0;
+	uint32_t status, late;
+	uint8_t first = 4, last = 0, i;
+
+	if (!groupMeasured) groupMeasure();
+	for (i = 0; i < 7; i++){
+		if (timers & TIMER_BIT(i)){
+			if (groupStore[i] < first) first = groupStore[i];
+			if (groupStore[i] > last) last = groupStore[i];
+		}
+	}
+	if (first > last) return 0;
+
+	for (i = 0; i < 7; i++){
+		if ((timers & TIMER_BIT(i)) && groupTicks[i] != 0){
+			late = (groupStore[i] - first) * groupGap4 / 4;
+			timerSetCount(i, ((uint64_t)timerCount(i) + (late + groupPrescale[i] / 2) / groupPrescale[i]) % groupTicks[i]);
+			groupTicks[i] = 0;
+		}
+	}
+
+	status = disableInterrupts();
+	T1CONSET = on1;
+	T2CONSET = on2;
+	T3CONSET = on3;
+	T4CONSET = on4;
+	T5CONSET = on5;
+	restoreInterrupts(status);
+
+	return (last - first) * groupGap4 / 4;
+}
+
+/* --------------------------------------------------------------------------------------------------------------------------------------- */
+/*	stopTimerGroup()
+**
+**	Parameters:
+**		timers:	The timers to stop, OR'd together <TIMER_BIT(TIMER1) ... TIMER_BIT(TIMER45)>
+**
+**	Return Value:
+**		none
+**
+**	Errors:
+**		none
+**
+**  Description:
+**		Freezes a set of timers with the same fixed sequence as startTimerGroup(). Their counts and settings are
+**		kept, so startTimerGroup() resumes them in phase. Interrupts are left enabled.
+**
+**	Example:
+**		stopTimerGroup(TIMER_BIT(TIMER2) | TIMER_BIT(TIMER3));
+*/
+void stopTimerGroup(uint8_t timers){
+
+	uint32_t off1 = (timers & TIMER_BIT(TIMER1)) ? T_ON : 0;
+	uint32_t off2 = (timers & (TIMER_BIT(TIMER2) | TIMER_BIT(TIMER23))) ? T_ON : 0;
+	uint32_t off3 = (timers & TIMER_BIT(TIMER3)) ? T_ON : 0;
+	uint32_t off4 = (timers & (TIMER_BIT(TIMER4) | TIMER_BIT(TIMER45))) ? T_ON : 0;
+	uint32_t off5 = (timers & TIMER_BIT(TIMER5)) ? T_ON : 0;
+	uint32_t status;
+
+	status = disableInterrupts();
+	T1CONCLR = off1;
+	T2CONCLR = off2;
+	T3CONCLR = off3;
+	T4CONCLR = off4;
+	T5CONCLR = off5;
+	restoreInterrupts(status);
+}
+
+//Installs handler on a timer's vector and sets its priority. timerNum is the interrupt slot (TIMER1-TIMER5).
+static void setTimerVector(uint8_t timerNum, isrFunc handler)
+{
         switch (timerNum)
         {
             case TIMER1:
-                IEC0bits.T1IE     =	0;
-                IFS0bits.T1IF     =	0;
-				setIntVector(_TIMER_1_VECTOR, (isrFunc) Timer1IntHandler);
-                IFS0CLR = _IFS0_T1IF_MASK;
+				setIntVector(_TIMER_1_VECTOR, handler);
 				IPC1CLR = _IPC1_T1IP_MASK, IPC1SET = ((_T1_IPL_IPC) << _IPC1_T1IP_POSITION);
 				IPC1CLR = _IPC1_T1IS_MASK, IPC1SET = ((_T1_SPL_IPC) << _IPC1_T1IS_POSITION);
-				IEC0SET = (1 << _IEC0_T1IE_POSITION);
                 break;
 
             case TIMER2:
-				IEC0bits.T2IE     =	0;
-                IFS0bits.T2IF     =	0;
-                setIntVector(_TIMER_2_VECTOR, (isrFunc) Timer2IntHandler);
-                IFS0CLR = _IFS0_T2IF_MASK;
+                setIntVector(_TIMER_2_VECTOR, handler);
 				IPC2CLR = _IPC2_T2IP_MASK, IPC2SET = ((_T2_IPL_IPC) << _IPC2_T2IP_POSITION);
 				IPC2CLR = _IPC2_T2IS_MASK, IPC2SET = ((_T2_SPL_IPC) << _IPC2_T2IS_POSITION);
-				IEC0SET = (1 << _IEC0_T2IE_POSITION);
                 break;
 
             case TIMER3:
-				IEC0bits.T3IE     =	0;
-                IFS0bits.T3IF     =	0;
-                setIntVector(_TIMER_3_VECTOR, (isrFunc) Timer3IntHandler);
-				IFS0CLR = _IFS0_T3IF_MASK;
+                setIntVector(_TIMER_3_VECTOR, handler);
 				IPC3CLR = _IPC3_T3IP_MASK, IPC3SET = ((_T3_IPL_IPC) << _IPC3_T3IP_POSITION);
 				IPC3CLR = _IPC3_T3IS_MASK, IPC3SET = ((_T3_SPL_IPC) << _IPC3_T3IS_POSITION);
-				IEC0SET = (1 << _IEC0_T3IE_POSITION);
                 break;
 
             case TIMER4:
-				IEC0bits.T4IE     =	0;
-                IFS0bits.T4IF     =	0;
-                setIntVector(_TIMER_4_VECTOR, (isrFunc) Timer4IntHandler);
-				IFS0CLR = _IFS0_T4IF_MASK;
+                setIntVector(_TIMER_4_VECTOR, handler);
 				IPC4CLR = _IPC4_T4IP_MASK, IPC4SET = ((_T4_IPL_IPC) << _IPC4_T4IP_POSITION);
 				IPC4CLR = _IPC4_T4IS_MASK, IPC4SET = ((_T4_SPL_IPC) << _IPC4_T4IS_POSITION);
-				IEC0SET = (1 << _IEC0_T1IE_POSITION);
                 break;
 
             case TIMER5:
-			    IEC0bits.T5IE     =	0;
-                IFS0bits.T5IF     =	0;
-                setIntVector(_TIMER_5_VECTOR, (isrFunc) Timer5IntHandler);
-				IFS0CLR = _IFS0_T5IF_MASK;
+                setIntVector(_TIMER_5_VECTOR, handler);
 				#if defined(__PIC32MX__)
 					IPC5CLR = _IPC5_T5IP_MASK, IPC5SET = ((_T5_IPL_IPC) << _IPC5_T5IP_POSITION);
 					IPC5CLR = _IPC5_T5IS_MASK, IPC5SET = ((_T5_SPL_IPC) << _IPC5_T5IS_POSITION);
-				#else if defined(__PIC32MZ__)
-					IPC6CLR = _IPC6_T5IP_MASK, IPC5SET = ((_T5_IPL_IPC) << _IPC6_T5IP_POSITION);
-					IPC6CLR = _IPC6_T5IS_MASK, IPC5SET = ((_T5_SPL_IPC) << _IPC6_T5IS_POSITION);
+				#elif defined(__PIC32MZ__)
+					IPC6CLR = _IPC6_T5IP_MASK, IPC6SET = ((_T5_IPL_IPC) << _IPC6_T5IP_POSITION);
+					IPC6CLR = _IPC6_T5IS_MASK, IPC6SET = ((_T5_SPL_IPC) << _IPC6_T5IS_POSITION);
 				#endif
-				IEC0SET = (1 << _IEC0_T1IE_POSITION);
                 break;
-				
         }
-    }
 }
 
+static const isrFunc timerHandlers[5] = {(isrFunc) Timer1IntHandler, (isrFunc) Timer2IntHandler, (isrFunc) Timer3IntHandler,
+										 (isrFunc) Timer4IntHandler, (isrFunc) Timer5IntHandler};
+
 /* --------------------------------------------------------------------------------------------------------------------------------------- */
-/*	detachTimerInterrupt()
+/*	attachTimerInterrupt()
 **
 **	Parameters:
-**		timerNum:	The timer interrupt to detach<TIMER1, TIMER2, TIMER3, TIMER4, TIMER5, TIMER23, TIMER45>
+**		timerNum:	The timer interrupt to set <TIMER1, TIMER2, TIMER3, TIMER4, TIMER5, TIMER23, TIMER45, TIMERCORE> 
+**		userfunc:	The interrupt service routine to jump to when the interrupt is triggered
 **
 **	Return Value:
 **		none
@@ -330,48 +834,43 @@ void attachTimerInterrupt(uint8_t timerNum, void (*userFunc)(void))
 **		none
 **
 **  Description:
-**		Detaches the interrupt from the previously specified ISR and disables the timer interrupt
+**		Specifies a function as an interrupt service routine for a timer. If the timer already has a function
+**		attached, the new one is swapped in with a single store, without disabling the interrupt or dropping a
+**		pending one, so this is safe to call while the timer is running or from another ISR. If the interrupt was
+**		disabled, a flag raised meanwhile is cleared first, so the new function doesn't run for an old event.
 **
 **	Example:
-**		detachTimerInterrupt(TIMER23);	Detaches timer 2-3 from its ISR, 
+**		attachTimerInterrupt(TIMER23, toggleLED);	Attaches the 32 bit timer 2-3 to the function toggleLED();
 */
-void detachTimerInterrupt(uint8_t timerNum)
+void attachTimerInterrupt(uint8_t timerNum, void (*userFunc)(void))
 {
+	if (timerNum == TIMERCORE) coreFunc = userFunc, coreEnabled = true;
     if (timerNum < 7)
     {
-		if (timerNum==TIMER23) timerNum=TIMER3;
-		else if (timerNum==TIMER45) timerNum=TIMER5;
-        switch (timerNum){
-            case TIMER1:
-                IEC0bits.T1IE     =	0;
-                clearIntVector(_TIMER_1_VECTOR);
-                break;
-            case TIMER2:
-                IEC0bits.T2IE     =	0;
-                clearIntVector(_TIMER_2_VECTOR);
-                break;
-            case (TIMER3):
-                IEC0bits.T3IE     =	0;
-                clearIntVector(_TIMER_3_VECTOR);
-                break;
-            case TIMER4:
-                IEC0bits.T4IE     =	0;
-                clearIntVector(_TIMER_4_VECTOR);
-                break;
-            case (TIMER5):
-                IEC0bits.T5IE     =	0;
-                clearIntVector(_TIMER_5_VECTOR);
-               break;
+		timerNum = timerSlot(timerNum);
+
+		if (intFunc[timerNum] != 0){
+			if (!(IEC0 & timerIEMask[timerNum])) IFS0CLR = timerIFMask[timerNum];	//Raised while disabled, it's stale
+			intFunc[timerNum]	=	userFunc;	//Vector and priority are already set up
+			IEC0SET = timerIEMask[timerNum];
+			return;
 		}
-        intFunc[timerNum]	=	0;
+
+		IEC0CLR = timerIEMask[timerNum];
+		IFS0CLR = timerIFMask[timerNum];
+        intFunc[timerNum]	=	userFunc;
+
+		setTimerVector(timerNum, timerHandlers[timerNum]);
+		IEC0SET = timerIEMask[timerNum];
     }
 }
 
 /* --------------------------------------------------------------------------------------------------------------------------------------- */
-/*	disableTimerInterrupt()
+/*	bindTimerVector()
 **
 **	Parameters:
-**		timerNum:	The timer interrupt to disable<TIMER1, TIMER2, TIMER3, TIMER4, TIMER5, TIMER23, TIMER45>
+**		timerNum:	The timer interrupt to bind <TIMER1, TIMER2, TIMER3, TIMER4, TIMER5, TIMER23, TIMER45>
+**		handler:	A complete interrupt handler, which must clear the timer's interrupt flag itself
 **
 **	Return Value:
 **		none
@@ -380,42 +879,31 @@ void detachTimerInterrupt(uint8_t timerNum)
 **		none
 **
 **  Description:
-**		Turns off the timer interrupt without detaching the ISR
+**		Installs handler directly on the timer's vector, bypassing the intFunc[] dispatch, and enables the
+**		interrupt. Normally called through bindTimerISR<>(). attachTimerInterrupt() puts the library's own
+**		handler back, and detachTimerInterrupt() removes either one.
 **
 **	Example:
-**		disableTimerInterrupt(TIMER4);	Disables timer 4 
+**		bindTimerVector(TIMER3, (isrFunc) myTimer3Handler);
 */
-void disableTimerInterrupt(uint8_t timerNum)
+void bindTimerVector(uint8_t timerNum, isrFunc handler)
 {
     if (timerNum < 7)
     {
-		if (timerNum==TIMER23) timerNum=TIMER3;	
-		else if (timerNum==TIMER45) timerNum=TIMER5;
-        switch (timerNum){
-            case TIMER1:
-                IEC0bits.T1IE     =	0;
-                break;
-            case TIMER2:
-                IEC0bits.T2IE     =	0;
-                break;
-            case (TIMER3):
-                IEC0bits.T3IE     =	0;
-                break;
-            case TIMER4:
-                IEC0bits.T4IE     =	0;
-                break;
-            case (TIMER5):
-                IEC0bits.T5IE     =	0;
-               break;
-		}
+		timerNum = timerSlot(timerNum);
+		IEC0CLR = timerIEMask[timerNum];
+		IFS0CLR = timerIFMask[timerNum];
+        intFunc[timerNum]	=	0;		//So the next attachTimerInterrupt() reinstalls the library handler
+		setTimerVector(timerNum, handler);
+		IEC0SET = timerIEMask[timerNum];
     }
 }
 
 /* --------------------------------------------------------------------------------------------------------------------------------------- */
-/*	enableTimerInterrupt()
+/*	detachTimerInterrupt()
 **
 **	Parameters:
-**		timerNum:	The timer interrupt to enable<TIMER1, TIMER2, TIMER3, TIMER4, TIMER5, TIMER23, TIMER45>
+**		timerNum:	The timer interrupt to detach<TIMER1, TIMER2, TIMER3, TIMER4, TIMER5, TIMER23, TIMER45, TIMERCORE>
 **
 **	Return Value:
 **		none
@@ -424,44 +912,44 @@ void disableTimerInterrupt(uint8_t timerNum)
 **		none
 **
 **  Description:
-**		Turns on the timer interrupt
+**		Detaches the interrupt from the previously specified ISR and disables the timer interrupt
 **
 **	Example:
-**		enableTimerInterrupt(TIMER4);	Enables timer 4 
+**		detachTimerInterrupt(TIMER23);	Detaches timer 2-3 from its ISR, 
 */
-void enableTimerInterrupt(uint8_t timerNum)
+void detachTimerInterrupt(uint8_t timerNum)
 {
+	if (timerNum == TIMERCORE) coreEnabled = false, coreFunc = 0;
     if (timerNum < 7)
     {
-		if (timerNum==TIMER23) timerNum=TIMER3;	
-		else if (timerNum==TIMER45) timerNum=TIMER5;
+		timerNum = timerSlot(timerNum);
+		IEC0CLR = timerIEMask[timerNum];
         switch (timerNum){
             case TIMER1:
-                IEC0bits.T1IE     =	1;
+                clearIntVector(_TIMER_1_VECTOR);
                 break;
             case TIMER2:
-                IEC0bits.T2IE     =	1;
+                clearIntVector(_TIMER_2_VECTOR);
                 break;
             case (TIMER3):
-                IEC0bits.T3IE     =	1;
+                clearIntVector(_TIMER_3_VECTOR);
                 break;
             case TIMER4:
-                IEC0bits.T4IE     =	1;
+                clearIntVector(_TIMER_4_VECTOR);
                 break;
             case (TIMER5):
-                IEC0bits.T5IE     =	1;
+                clearIntVector(_TIMER_5_VECTOR);
                break;
 		}
+        intFunc[timerNum]	=	0;
     }
 }
 
 /* --------------------------------------------------------------------------------------------------------------------------------------- */
-/*	startPWM
+/*	disableTimerInterrupt()
 **
 **	Parameters:
-**		timerNum:	The timer to use, with the period of the PWM <TIMER2, TIMER3, TIMER23>
-**		OCnum:	The output compare module to use <OC1, OC2, OC3, OC4, OC5>
-**		dutycycle:	The duty cycle (out of 100%) of the PWM
+**		timerNum:	The timer interrupt to disable<TIMER1, TIMER2, TIMER3, TIMER4, TIMER5, TIMER23, TIMER45, TIMERCORE>
 **
 **	Return Value:
 **		none
@@ -470,16 +958,115 @@ void enableTimerInterrupt(uint8_t timerNum)
 **		none
 **
 **  Description:
-**		Enables one of the output compare modules as a PWM with the specified duty cycle,
-**		and the period of the specified timer.
+**		Turns off the timer interrupt without detaching the ISR
 **
 **	Example:
-**		startPWM(TIMER2, OC1, 80);		Initializes OC1 as a PWM output with 80% duty cycle, and TIMER2's period
+**		disableTimerInterrupt(TIMER4);	Disables timer 4 
 */
-void startPWM(uint8_t timerNum, uint8_t OCnum, uint8_t dutycycle){
-	
-	unsigned long outputCompareValue;
-	
+void disableTimerInterrupt(uint8_t timerNum)
+{
+    if (timerNum < 7) IEC0CLR = timerIEMask[timerSlot(timerNum)];
+	else if (timerNum == TIMERCORE) coreEnabled = false;	//The core timer interrupt itself keeps running millis()
+}
+
+/* --------------------------------------------------------------------------------------------------------------------------------------- */
+/*	enableTimerInterrupt()
+**
+**	Parameters:
+**		timerNum:	The timer interrupt to enable<TIMER1, TIMER2, TIMER3, TIMER4, TIMER5, TIMER23, TIMER45, TIMERCORE>
+**
+**	Return Value:
+**		none
+**
+**	Errors:
+**		none
+**
+**  Description:
+**		Turns on the timer interrupt
+**
+**	Example:
+**		enableTimerInterrupt(TIMER4);	Enables timer 4 
+*/
+void enableTimerInterrupt(uint8_t timerNum)
+{
+    if (timerNum < 7) IEC0SET = timerIEMask[timerSlot(timerNum)];
+	else if (timerNum == TIMERCORE) coreEnabled = true;
+}
+
+/* --------------------------------------------------------------------------------------------------------------------------------------- */
+/*	disableTimerInterrupts()
+**
+**	Parameters:
+**		mask:	The timer interrupts to disable, OR'd together <TIMER1_INT, TIMER2_INT, TIMER3_INT, TIMER4_INT, TIMER5_INT,
+**				TIMER23_INT, TIMER45_INT>
+**
+**	Return Value:
+**		none
+**
+**	Errors:
+**		none
+**
+**  Description:
+**		Turns off several timer interrupts with a single IEC0CLR write, so they all stop at the same instant and
+**		no other interrupt enable bits are touched.
+**
+**	Example:
+**		disableTimerInterrupts(TIMER2_INT | TIMER45_INT);
+*/
+void disableTimerInterrupts(uint32_t mask)
+{
+	IEC0CLR = mask & TIMER_ALL_INT;
+}
+
+/* --------------------------------------------------------------------------------------------------------------------------------------- */
+/*	enableTimerInterrupts()
+**
+**	Parameters:
+**		mask:	The timer interrupts to enable, OR'd together <TIMER1_INT, TIMER2_INT, TIMER3_INT, TIMER4_INT, TIMER5_INT,
+**				TIMER23_INT, TIMER45_INT>
+**
+**	Return Value:
+**		none
+**
+**	Errors:
+**		none
+**
+**  Description:
+**		Turns on several timer interrupts with a single IEC0SET write.
+**
+**	Example:
+**		enableTimerInterrupts(TIMER2_INT | TIMER45_INT);
+*/
+void enableTimerInterrupts(uint32_t mask)
+{
+	IEC0SET = mask & TIMER_ALL_INT;
+}
+
+/* --------------------------------------------------------------------------------------------------------------------------------------- */
+/*	startPWM
+**
+**	Parameters:
+**		timerNum:	The timer to use, with the period of the PWM <TIMER2, TIMER3, TIMER23>
+**		OCnum:	The output compare module to use <OC1, OC2, OC3, OC4, OC5>
+**		dutycycle:	The duty cycle (out of 100%) of the PWM
+**
+**	Return Value:
+**		none
+**
+**	Errors:
+**		none
+**
+**  Description:
+**		Enables one of the output compare modules as a PWM with the specified duty cycle,
+**		and the period of the specified timer.
+**
+**	Example:
+**		startPWM(TIMER2, OC1, 80);		Initializes OC1 as a PWM output with 80% duty cycle, and TIMER2's period
+*/
+void startPWM(uint8_t timerNum, uint8_t OCnum, uint8_t dutycycle){
+	
+	unsigned long outputCompareValue;
+	
 	if (dutycycle<=100){
 		switch(timerNum){
 		case TIMER2:
@@ -639,66 +1226,1177 @@ void setDutyCycle(uint8_t OCnum, float dutycycle){
 	}
 }
 
+/* --------------------------------------------------------------------------------------------------------------------------------------- */
+/*	counterCheckThreshold()
+**
+**	Called with the slot's interrupt masked (from its ISR, or with TxIE cleared). Fires the threshold callback once
+**	the count reaches it. In the edge counting modes, when the threshold falls inside the current hardware period
+**	PRx is pulled in so the period match lands exactly on it. A period is never shortened below CNT_MIN_PERIOD
+**	counts: until the ISR restores PRx the timer keeps wrapping at the short period, and only one wrap is folded in.
+**	A threshold less than CNT_MIN_PERIOD past the start of the next period is reached in two steps, this period
+**	shortened to leave CNT_MIN_PERIOD for the next. One that is already that close fires at CNT_MIN_PERIOD, late by
+**	under CNT_MIN_PERIOD counts.
+*/
+static void counterCheckThreshold(uint8_t slot){
+	voidFuncPtr func = cntFunc[slot];
+	uint8_t timerNum = cntTimer[slot];
+	uint64_t reached = cntBase[slot];
+	uint32_t max = timerMaxPeriod(timerNum);
+	uint32_t period, count;
+
+	if (func == 0) return;
+	if (cntMode[slot] != COUNT_GATED && reached < cntThreshold[slot]){
+		uint64_t remaining = cntThreshold[slot] - reached;
+		if (remaining < (uint64_t)max + CNT_MIN_PERIOD){
+			if (remaining > max) period = remaining - CNT_MIN_PERIOD;	//Leave the next period long enough
+			else if (remaining < CNT_MIN_PERIOD) period = CNT_MIN_PERIOD;	//Can't be exact, fire a little late
+			else period = remaining;
+			cntPeriod[slot] = period-1;
+			timerSetPR(timerNum, period-1);
+			count = timerCount(timerNum);
+			if (count <= period-1) return;				//The period match is still ahead
+			cntPeriod[slot] = max;						//Already counted past it
+			timerSetPR(timerNum, max);
+			if (count >= remaining) reached = cntThreshold[slot];
+		}
+	}
+	if (reached >= cntThreshold[slot]){
+		cntFunc[slot] = 0;
+		(*func)();
+	}
+}
+
+//Counter ISR, bound straight to the vector by startCounter(). The base is folded in and TxIF cleared with interrupts
+//off, so a higher priority reader sees either the flag set with the old base, or the flag clear with the new one.
+//It can't go through intFunc[]: the library handlers clear TxIF before the call, and a reader landing in between
+//would see the flag clear with the old base and lose a whole period.
+static void counterISR(uint8_t slot){
+	uint8_t timerNum = cntTimer[slot];
+	uint32_t status = disableInterrupts();
+
+	if (cntMode[slot] == COUNT_GATED){
+		cntBase[slot] += timerCount(timerNum);	//The gate just closed, so TMRx is holding still
+		timerSetCount(timerNum, 0);
+	}
+	else{
+		cntBase[slot] += (uint64_t)cntPeriod[slot] + 1;
+		if (cntPeriod[slot] != timerMaxPeriod(timerNum)){	//Period was shortened to hit the threshold
+			cntPeriod[slot] = timerMaxPeriod(timerNum);
+			timerSetPR(timerNum, timerMaxPeriod(timerNum));
+		}
+	}
+	IFS0CLR = timerIFMask[slot];
+	cntSeq[slot]++;
+	restoreInterrupts(status);
+	counterCheckThreshold(slot);
+}
+
+static void __attribute__((interrupt(),nomips16)) CounterIntHandler1(void){ counterISR(TIMER1); }
+static void __attribute__((interrupt(),nomips16)) CounterIntHandler2(void){ counterISR(TIMER2); }
+static void __attribute__((interrupt(),nomips16)) CounterIntHandler3(void){ counterISR(TIMER3); }
+static void __attribute__((interrupt(),nomips16)) CounterIntHandler4(void){ counterISR(TIMER4); }
+static void __attribute__((interrupt(),nomips16)) CounterIntHandler5(void){ counterISR(TIMER5); }
+
+static const isrFunc counterHandlers[5] = {(isrFunc) CounterIntHandler1, (isrFunc) CounterIntHandler2, (isrFunc) CounterIntHandler3,
+										   (isrFunc) CounterIntHandler4, (isrFunc) CounterIntHandler5};
+
+/* --------------------------------------------------------------------------------------------------------------------------------------- */
+/*	startCounter()
+**
+**	Parameters:
+**		timerNum:	The timer to count with <TIMER1, TIMER2, TIMER3, TIMER4, TIMER5, TIMER23, TIMER45>
+**		mode:		<COUNT_EXTERNAL, COUNT_EXTERNAL_SYNC, COUNT_GATED>
+**		prescale:	Input divider <1, 2, 4, 8, 16, 32, 64, 256>. TIMER1 only supports 1, 8, 64 and 256.
+**
+**	Return Value:
+**		none
+**
+**	Errors:
+**		An unsupported prescale is rounded up to the next one the timer has.
+**
+**  Description:
+**		Runs a timer as a hardware event counter and clears its count. COUNT_EXTERNAL and COUNT_EXTERNAL_SYNC count
+**		rising edges on the timer's TxCK pin. Only TIMER1 can count asynchronously; the other timers always synchronize
+**		TxCK to the peripheral clock, so both modes are the same for them. COUNT_GATED counts peripheral clock cycles
+**		while TxCK is high, and folds each window into the count when the gate closes.
+**
+**		The hardware counts every edge. The CPU only takes one interrupt each time the hardware period wraps
+**		(every 65536 or 2^32 counts, times the prescale), or once per gate window in COUNT_GATED. This uses the
+**		timer's interrupt, so don't attach another function to it while counting. In COUNT_GATED a window longer
+**		than the hardware period wraps, so use a 32 bit timer or a prescale for long gates.
+**
+**	Example:
+**		startCounter(TIMER23, COUNT_EXTERNAL, 1);	Counts every rising edge on T2CK into a 64 bit count
+*/
+void startCounter(uint8_t timerNum, uint8_t mode, uint16_t prescale){
+
+	uint32_t con;
+	uint8_t slot;
+
+	if (timerNum < 7){
+		slot = timerSlot(timerNum);
+		con = prescaleBits(timerNum, prescale);
+		switch(mode){
+			case COUNT_EXTERNAL:		con |= T_SOURCE_EXT;
+				break;
+			case COUNT_EXTERNAL_SYNC:	con |= T_SOURCE_EXT;
+				if (timerNum==TIMER1) con |= T_SYNC_EXT_ON;	//Always synchronized on the other timers
+				break;
+			case COUNT_GATED:			con |= T_GATE_ON;
+				break;
+			default:
+				return;
+		}
+
+		stopTimer(timerNum);
+		IFS0CLR = timerIFMask[slot];
+		cntFunc[slot] = 0;
+		cntMode[slot] = mode;
+		cntTimer[slot] = timerNum;
+		cntBase[slot] = 0;
+		cntPeriod[slot] = timerMaxPeriod(timerNum);
+		cntSeq[slot]++;
+
+		timerWriteCon(timerNum, con);
+		timerSetCount(timerNum, 0);
+		timerSetPR(timerNum, timerMaxPeriod(timerNum));
+		bindTimerVector(timerNum, counterHandlers[slot]);
+		timerOn(timerNum);
+	}
+}
+
+/* --------------------------------------------------------------------------------------------------------------------------------------- */
+/*	stopCounter()
+**
+**	Parameters:
+**		timerNum:	The counter to stop <TIMER1, TIMER2, TIMER3, TIMER4, TIMER5, TIMER23, TIMER45>
+**
+**	Return Value:
+**		none
+**
+**	Errors:
+**		none
+**
+**  Description:
+**		Stops counting, disarms the threshold and detaches the counter interrupt. The last count can still be read.
+**
+**	Example:
+**		stopCounter(TIMER1);
+*/
+void stopCounter(uint8_t timerNum){
+
+	uint8_t slot;
+
+	if (timerNum < 7){
+		slot = timerSlot(timerNum);
+		cntFunc[slot] = 0;
+		IEC0CLR = timerIEMask[slot];
+		timerOff(timerNum);
+		if (IFS0 & timerIFMask[slot]) counterISR(slot);		//Fold in the last wrap, stopTimer() clears the flag
+		stopTimer(timerNum);
+		detachTimerInterrupt(timerNum);
+	}
+}
+
+/* --------------------------------------------------------------------------------------------------------------------------------------- */
+/*	resetCounter()
+**
+**	Parameters:
+**		timerNum:	The counter to clear <TIMER1, TIMER2, TIMER3, TIMER4, TIMER5, TIMER23, TIMER45>
+**
+**	Return Value:
+**		none
+**
+**	Errors:
+**		none
+**
+**  Description:
+**		Sets the count back to 0 without stopping the counter. An armed threshold is kept and is now measured from 0.
+**
+**	Example:
+**		resetCounter(TIMER23);
+*/
+void resetCounter(uint8_t timerNum){
+
+	uint8_t slot;
+	uint32_t ie;
+
+	if (timerNum < 7){
+		slot = timerSlot(timerNum);
+		ie = IEC0 & timerIEMask[slot];
+		IEC0CLR = timerIEMask[slot];
+
+		timerSetCount(timerNum, 0);
+		IFS0CLR = timerIFMask[slot];		//A pending wrap belongs to the old count
+		cntBase[slot] = 0;
+		cntPeriod[slot] = timerMaxPeriod(timerNum);
+		timerSetPR(timerNum, timerMaxPeriod(timerNum));
+		cntSeq[slot]++;
+		counterCheckThreshold(slot);
+
+		IEC0SET = ie;
+	}
+}
+
+/* --------------------------------------------------------------------------------------------------------------------------------------- */
+/*	readCounter64()
+**
+**	Parameters:
+**		timerNum:	The counter to read <TIMER1, TIMER2, TIMER3, TIMER4, TIMER5, TIMER23, TIMER45>
+**
+**	Return Value:
+**		The number of counts since startCounter() or resetCounter()
+**
+**	Errors:
+**		none
+**
+**  Description:
+**		Reads the full count without disabling interrupts. If the counter ISR runs part way through the read,
+**		the read is retried. A wrap that has not been serviced yet (read from a higher priority ISR, or with
+**		interrupts off) is still accounted for, as long as it is the only one. The counter ISR folds in the wrap
+**		and clears the flag as one step, so a reader that preempts it never counts the same wrap twice.
+**
+**	Example:
+**		uint64_t pulses = readCounter64(TIMER23);
+*/
+uint64_t readCounter64(uint8_t timerNum){
+
+	uint8_t slot;
+	uint32_t seq, count;
+	uint64_t base;
+
+	if (timerNum >= 7) return 0;
+	slot = timerSlot(timerNum);
+	do{
+		seq = cntSeq[slot];
+		base = cntBase[slot];
+		count = timerCount(timerNum);
+		if (cntMode[slot] != COUNT_GATED && (IFS0 & timerIFMask[slot])){
+			count = timerCount(timerNum);	//Re-read, the first read may be from before the wrap
+			base += (uint64_t)cntPeriod[slot] + 1;
+		}
+	} while (seq != cntSeq[slot]);
+	return base + count;
+}
+
+/* --------------------------------------------------------------------------------------------------------------------------------------- */
+/*	readCounter()
+**
+**	Parameters:
+**		timerNum:	The counter to read <TIMER1, TIMER2, TIMER3, TIMER4, TIMER5, TIMER23, TIMER45>
+**
+**	Return Value:
+**		The low 32 bits of the count
+**
+**	Errors:
+**		none
+**
+**  Description:
+**		Same as readCounter64(), for when the count is known to fit, or only differences are needed.
+**
+**	Example:
+**		uint32_t pulses = readCounter(TIMER1);
+*/
+uint32_t readCounter(uint8_t timerNum){
+	return (uint32_t)readCounter64(timerNum);
+}
+
+/* --------------------------------------------------------------------------------------------------------------------------------------- */
+/*	setCounterThreshold()
+**
+**	Parameters:
+**		timerNum:	The counter to watch <TIMER1, TIMER2, TIMER3, TIMER4, TIMER5, TIMER23, TIMER45>
+**		count:		The count to call userFunc at
+**		userFunc:	The function to call, or 0 to disarm
+**
+**	Return Value:
+**		none
+**
+**	Errors:
+**		none
+**
+**  Description:
+**		Calls userFunc once, from the counter interrupt, when the count reaches the threshold. In the edge counting
+**		modes the hardware period is shortened so the interrupt lands exactly on the threshold edge. It is never
+**		shortened below 256 timer counts (256 times the prescale in edges), so the ISR has time to put it back before
+**		the timer wraps again. A threshold within the first 256 counts of a hardware period fires at count 256 of it
+**		instead; this only happens when it is armed that early in the period. In COUNT_GATED it is checked each time
+**		the gate closes. If the count is already past the threshold, userFunc is called right away. Re-arm from
+**		userFunc for repeating thresholds.
+**
+**	Example:
+**		setCounterThreshold(TIMER1, readCounter64(TIMER1) + 1000, batchDone);	Calls batchDone() 1000 edges from now
+*/
+void setCounterThreshold(uint8_t timerNum, uint64_t count, void (*userFunc)(void)){
+
+	uint8_t slot;
+	uint32_t ie;
+
+	if (timerNum < 7){
+		slot = timerSlot(timerNum);
+		ie = IEC0 & timerIEMask[slot];
+		IEC0CLR = timerIEMask[slot];
+
+		cntThreshold[slot] = count;
+		cntFunc[slot] = userFunc;
+		if (!(IFS0 & timerIFMask[slot])) counterCheckThreshold(slot);	//Otherwise the pending ISR will check it
+
+		IEC0SET = ie;
+	}
+}
+
+/* --------------------------------------------------------------------------------------------------------------------------------------- */
+/*	Local helpers for the output compare modules
+*/
+static void ocWriteCon(uint8_t OCnum, uint32_t con){
+	switch(OCnum){
+		case OC1: OC1CON=con; break;
+		case OC2: OC2CON=con; break;
+		case OC3: OC3CON=con; break;
+		case OC4: OC4CON=con; break;
+		case OC5: OC5CON=con; break;
+	}
+}
+
+static void ocSetCompare(uint8_t OCnum, uint32_t r, uint32_t rs){
+	switch(OCnum){
+		case OC1: OC1R=r, OC1RS=rs; break;
+		case OC2: OC2R=r, OC2RS=rs; break;
+		case OC3: OC3R=r, OC3RS=rs; break;
+		case OC4: OC4R=r, OC4RS=rs; break;
+		case OC5: OC5R=r, OC5RS=rs; break;
+	}
+}
+
+//Acceleration weight for the next step. The trapezoid always uses full acceleration. The S-curve scales it by the
+//ramp position, no further along than limit.
+static uint32_t stepDelta(uint8_t axis, uint32_t limit){
+	uint32_t d = (stepRamp[axis] < limit) ? stepRamp[axis] : limit;
+
+	if (stepProfile[axis] != STEPPER_SCURVE) return STEP_DELTA_MAX;
+	d = d * STEP_DELTA_MAX / stepJerk[axis];
+	if (d < 1) return 1;
+	if (d > STEP_DELTA_MAX) return STEP_DELTA_MAX;
+	return d;
+}
+
+//Loads the period in progress. The pulse sits at the end of the period, so it is always written well before its edges.
+static void stepLoadPeriod(uint8_t axis){
+	uint32_t period = (stepPeriod[axis] >> STEP_FRAC) - 1;
+
+	timerSetPR(TIMER2 + axis, period);
+	ocSetCompare(stepOC[axis], period - stepPulse[axis], period);
+}
+
+/* --------------------------------------------------------------------------------------------------------------------------------------- */
+//Stepper ISR, attached through intFunc[] by moveStepper(). Runs at the start of each step period, just after the
+//previous period's pulse.
+//
+//The next period comes from the recurrence in D. Austin, "Generate stepper-motor speed profiles in real time"
+//(Embedded Systems Programming, Jan 2005): c' = c - 2c/(4n+1) while accelerating. Here n is replaced by the
+//squared speed stepW, which grows by a weight delta per step (always the maximum for the trapezoid), so one integer
+//division per step gives both profiles. As in Austin's version the remainder is carried into the next division, so
+//the period keeps shrinking at high speed where each step's change is under one fraction bit. Only the period
+//decides when full speed is reached. Decelerating runs the same recurrence and the same ramp backwards, so the
+//axis ends the move at the speed it started from.
+static void stepperISR(uint8_t axis){
+	uint32_t remaining, c, delta, num, den;
+	bool easing;
+
+	stepPosition[axis] += stepDir[axis];
+	remaining = stepRemaining[axis] - 1;
+	stepRemaining[axis] = remaining;
+
+	if (remaining == 0){
+		ocWriteCon(stepOC[axis], 0);
+		timerWriteCon(TIMER2 + axis, 0);
+		IEC0CLR = timerIEMask[TIMER2 + axis];
+		stepPhase[axis] = STEP_IDLE;
+		return;
+	}
+
+	c = stepPeriod[axis];
+	if (stepPhase[axis] == STEP_ACCEL && remaining == stepAccelSteps[axis] + 1) stepPhase[axis] = STEP_CRUISE;	//Even split, hold the peak one step
+	if (stepPhase[axis] != STEP_DECEL && remaining <= stepAccelSteps[axis]){
+		stepPhase[axis] = STEP_DECEL;
+		stepRem[axis] = 0;
+		c = stepPeak[axis];		//The recurrence scales, so run it back from the unclamped period to end where it began
+	}
+
+	switch(stepPhase[axis]){
+		case STEP_ACCEL:
+			easing = (stepProfile[axis] == STEPPER_SCURVE && stepW[axis] >= stepWTaper[axis]);
+			if (easing){
+				if (stepRamp[axis] > 0) stepRamp[axis]--;
+				else stepTail[axis]++;		//Eased out before reaching full speed, creep at the smallest delta
+			}
+			else if (stepRamp[axis] < stepJerk[axis]) stepRamp[axis]++;
+			delta = stepDelta(axis, stepRamp[axis]);
+			if (delta > stepW[axis]) delta = stepW[axis];	//At most the trapezoid's first step, c' = 0.6c
+			num = 2 * c * delta + stepRem[axis];
+			den = 4 * stepW[axis] + delta;
+			c -= num / den;
+			stepRem[axis] = num % den;
+			stepW[axis] += delta;
+			stepAccelSteps[axis]++;
+			stepPeak[axis] = c;
+			if (c <= stepMinPeriod[axis] || stepW[axis] >= STEP_W_MAX){	//Only the period decides full speed
+				if (c < stepMinPeriod[axis]) c = stepMinPeriod[axis];
+				stepPhase[axis] = STEP_CRUISE;
+			}
+			break;
+		case STEP_DECEL:
+			if (stepTail[axis] > 0){		//Mirror the accelerating tail first, so the ramps cancel
+				stepTail[axis]--;
+				delta = 1;
+			}
+			else{
+				delta = stepDelta(axis, remaining);
+				if (stepRamp[axis] < stepJerk[axis]) stepRamp[axis]++;
+			}
+			if (delta > stepW[axis] / 2) delta = stepW[axis] / 2;	//Undoes the accelerating limit of delta <= stepW
+			if (delta > 0){
+				stepW[axis] -= delta;
+				if (4 * stepW[axis] > delta){
+					num = 2 * c * delta + stepRem[axis];
+					den = 4 * stepW[axis] - delta;
+					c += num / den;
+					stepRem[axis] = num % den;
+				}
+			}
+			break;
+	}
+	if ((c >> STEP_FRAC) > MAX16BIT) c = (uint32_t)MAX16BIT << STEP_FRAC;
+	stepPeriod[axis] = c;
+	stepLoadPeriod(axis);
+
+	if (remaining == 1){	//Hardware stops after the last pulse even if this ISR is late next time
+		ocWriteCon(stepOC[axis], 0);
+		ocWriteCon(stepOC[axis], OC_ON | OC_TIMER_MODE16 | (axis ? OC_TIMER3_SRC : OC_TIMER2_SRC) | OC_SINGLE_PULSE);
+	}
+}
+
+static void stepperISR2(void){ stepperISR(0); }
+static void stepperISR3(void){ stepperISR(1); }
+
+/* --------------------------------------------------------------------------------------------------------------------------------------- */
+/*	setupStepper()
+**
+**	Parameters:
+**		timerNum:	The timer to time the steps with <TIMER2, TIMER3>
+**		OCnum:		The output compare module driving the STEP input <OC1, OC2, OC3, OC4, OC5>
+**		dirPin:		The pin driving the DIR input
+**
+**	Return Value:
+**		none
+**
+**	Errors:
+**		Only TIMER2 and TIMER3 can clock an output compare module, so at most two axes can run at once.
+**
+**  Description:
+**		Sets up an axis for moveStepper(). The step position is set to 0.
+**
+**	Example:
+**		setupStepper(TIMER2, OC1, 4);	STEP on OC1 (pin 3), DIR on pin 4
+*/
+void setupStepper(uint8_t timerNum, uint8_t OCnum, uint8_t dirPin){
+
+	uint8_t axis = timerNum - TIMER2;
+
+	if (timerNum == TIMER2 || timerNum == TIMER3){
+		haltStepper(timerNum);
+		stepOC[axis] = OCnum;
+		stepDirPin[axis] = dirPin;
+		stepPosition[axis] = 0;
+		pinMode(dirPin, OUTPUT);
+	}
+}
+
+/* --------------------------------------------------------------------------------------------------------------------------------------- */
+/*	moveStepper()
+**
+**	Parameters:
+**		timerNum:	The axis to move <TIMER2, TIMER3>
+**		steps:		Number of steps to move. Negative steps drive DIR low.
+**		maxSpeed:	Cruise speed, in steps per second
+**		accel:		Acceleration and deceleration, in steps per second per second
+**		profile:	<STEPPER_TRAPEZOID, STEPPER_SCURVE>
+**
+**	Return Value:
+**		none
+**
+**	Errors:
+**		Speeds are limited to one step per STEPPER_MIN_PERIOD_US. A move already running is cut short. Does nothing
+**		if setupStepper() hasn't been called for the axis.
+**
+**  Description:
+**		Emits exactly |steps| pulses of STEPPER_PULSE_US on the OC pin, and returns at once. The edges come from the
+**		output compare hardware in continuous pulse mode, so they have no interrupt jitter. The last pulse is sent in
+**		single pulse mode, so the hardware stops after it on its own. The timer interrupt only loads the next
+**		period, using integer math. The square root to find the first step is only done once per move, here.
+**
+**		With STEPPER_TRAPEZOID the acceleration is constant. With STEPPER_SCURVE it ramps in from standstill and out
+**		toward full speed, and the other way round when decelerating, so reaching the same speed takes longer. Moves
+**		too short to reach maxSpeed accelerate for half of the steps and decelerate for the rest. The cruise speed
+**		is maxSpeed to within one timer tick.
+**
+**		A step can be at most 65536 timer ticks at /256, about 0.21 s at 80 MHz. When the first step from standstill
+**		would be longer than that (below about 21 steps/s/s for STEPPER_TRAPEZOID, 330 for STEPPER_SCURVE at 80 MHz),
+**		the move starts and ends at the first step of the ramp that fits, 5 to 8 steps/s, instead of at standstill.
+**		The ramp from there still has the requested acceleration.
+**
+**	Example:
+**		moveStepper(TIMER2, 3200, 4000, 8000, STEPPER_SCURVE);	3200 steps at up to 4000 steps/s
+*/
+void moveStepper(uint8_t timerNum, long steps, uint32_t maxSpeed, uint32_t accel, uint8_t profile){
+
+	static const uint16_t prescales[] = {1, 2, 4, 8, 16, 32, 64, 256};
+	uint8_t axis = timerNum - TIMER2;
+	uint32_t mode;
+	float exact, first, top, w;
+	uint16_t prescale = 1;
+	uint8_t i;
+
+	if ((timerNum != TIMER2 && timerNum != TIMER3) || steps == 0 || maxSpeed == 0 || accel == 0) return;
+	if (stepOC[axis] == 0) return;		//setupStepper() not called
+
+	haltStepper(timerNum);
+	stepDir[axis] = (steps > 0) ? 1 : -1;
+	digitalWrite(stepDirPin[axis], steps > 0 ? HIGH : LOW);
+	stepRemaining[axis] = (steps > 0) ? steps : -steps;
+	stepProfile[axis] = profile;
+
+	//Austin's exact first period is F*sqrt(2/accel), trimmed by 0.676 for the recurrence. Starting the S-curve at
+	//a delta of 1 instead of STEP_DELTA_MAX makes its first step sqrt(STEP_DELTA_MAX) times longer.
+	exact = F_CPU * sqrtf(2.0f / accel);
+	first = 0.676f * exact;
+	if (profile == STEPPER_SCURVE) first *= sqrtf(STEP_DELTA_MAX);
+	i = 0;
+	while (i < 7 && (first / prescales[i] > MAX16BIT || F_CPU / prescales[i] / maxSpeed > MAX16BIT)) i++;
+	prescale = prescales[i];
+
+	stepPulse[axis] = (F_CPU / 1000000) * STEPPER_PULSE_US / prescale;
+	if (stepPulse[axis] == 0) stepPulse[axis] = 1;
+	stepMinPeriod[axis] = F_CPU / prescale / maxSpeed;
+	if (stepMinPeriod[axis] < (F_CPU / 1000000) * STEPPER_MIN_PERIOD_US / prescale)
+		stepMinPeriod[axis] = (F_CPU / 1000000) * STEPPER_MIN_PERIOD_US / prescale;
+	if (stepMinPeriod[axis] > MAX16BIT) stepMinPeriod[axis] = MAX16BIT;
+
+	//Squared speed at maxSpeed: the step n where Austin's period exact/(2*sqrt(n)) reaches the minimum period.
+	//Capped so 4*stepW can't overflow in the ISR.
+	top = exact / prescale / (2.0f * stepMinPeriod[axis]);
+	top = top * top * STEP_DELTA_MAX;
+	stepWTop[axis] = (top > (float)STEP_W_MAX) ? STEP_W_MAX : (uint32_t)top;
+	if (stepWTop[axis] < STEP_DELTA_MAX) stepWTop[axis] = STEP_DELTA_MAX;
+	stepJerk[axis] = stepWTop[axis] / STEP_DELTA_MAX / 4;		//A quarter of the trapezoid's acceleration steps
+	if (stepJerk[axis] == 0) stepJerk[axis] = 1;
+	stepWTaper[axis] = stepWTop[axis] - STEP_DELTA_MAX * stepJerk[axis] / 2;
+	stepRamp[axis] = 0;
+	stepRem[axis] = 0;
+	stepTail[axis] = 0;
+	stepMinPeriod[axis] <<= STEP_FRAC;
+
+	first /= prescale;
+	stepW[axis] = (profile == STEPPER_SCURVE) ? 1 : STEP_DELTA_MAX;
+	if (first > MAX16BIT){
+		//Too slow to time from standstill. Skip ahead along the trapezoid's own recurrence to the first step whose
+		//period fits, and start there with stepW to match, so the ramp keeps the requested acceleration.
+		first = 0.676f * exact / prescale;
+		for (w = 1.0f; first > MAX16BIT; w += 1.0f) first *= (4.0f * w - 1.0f) / (4.0f * w + 1.0f);
+		stepW[axis] = (uint32_t)w * STEP_DELTA_MAX;
+	}
+	stepPeriod[axis] = (uint32_t)first << STEP_FRAC;
+	stepPeak[axis] = stepPeriod[axis];
+	stepAccelSteps[axis] = 0;
+	stepPhase[axis] = STEP_ACCEL;
+	if (stepPeriod[axis] <= stepMinPeriod[axis]){		//maxSpeed is below the first step's speed
+		stepPeriod[axis] = stepMinPeriod[axis];
+		stepPhase[axis] = STEP_CRUISE;
+	}
+
+	mode = (stepRemaining[axis] == 1) ? OC_SINGLE_PULSE : OC_CONTINUE_PULSE;
+	timerWriteCon(timerNum, prescaleBits(timerNum, prescale));
+	timerSetCount(timerNum, 0);
+	stepLoadPeriod(axis);
+	ocWriteCon(stepOC[axis], OC_ON | OC_TIMER_MODE16 | (axis ? OC_TIMER3_SRC : OC_TIMER2_SRC) | mode);
+	attachTimerInterrupt(timerNum, axis ? stepperISR3 : stepperISR2);
+	timerOn(timerNum);
+}
+
+/* --------------------------------------------------------------------------------------------------------------------------------------- */
+/*	stopStepper()
+**
+**	Parameters:
+**		timerNum:	The axis to stop <TIMER2, TIMER3>
+**
+**	Return Value:
+**		none
+**
+**	Errors:
+**		none
+**
+**  Description:
+**		Ends the current move early, decelerating along the same profile. Use haltStepper() to stop without
+**		decelerating.
+**
+**	Example:
+**		stopStepper(TIMER2);
+*/
+void stopStepper(uint8_t timerNum){
+
+	uint8_t axis = timerNum - TIMER2;
+
+	if (timerNum == TIMER2 || timerNum == TIMER3){
+		IEC0CLR = timerIEMask[timerNum];
+		if (stepPhase[axis] != STEP_IDLE){
+			if (stepRemaining[axis] > stepAccelSteps[axis] + 1) stepRemaining[axis] = stepAccelSteps[axis] + 1;
+			IEC0SET = timerIEMask[timerNum];
+		}
+	}
+}
+
+/* --------------------------------------------------------------------------------------------------------------------------------------- */
+/*	haltStepper()
+**
+**	Parameters:
+**		timerNum:	The axis to halt <TIMER2, TIMER3>
+**
+**	Return Value:
+**		none
+**
+**	Errors:
+**		none
+**
+**  Description:
+**		Stops stepping right away. A pulse already started is cut short and not counted.
+**
+**	Example:
+**		haltStepper(TIMER2);
+*/
+void haltStepper(uint8_t timerNum){
+
+	uint8_t axis = timerNum - TIMER2;
+
+	if (timerNum == TIMER2 || timerNum == TIMER3){
+		IEC0CLR = timerIEMask[timerNum];
+		timerWriteCon(timerNum, 0);
+		if (stepPhase[axis] != STEP_IDLE) ocWriteCon(stepOC[axis], 0);
+		IFS0CLR = timerIFMask[timerNum];
+		stepRemaining[axis] = 0;
+		stepPhase[axis] = STEP_IDLE;
+	}
+}
+
+/* --------------------------------------------------------------------------------------------------------------------------------------- */
+/*	stepperPosition()
+**
+**	Parameters:
+**		timerNum:	The axis to read <TIMER2, TIMER3>
+**
+**	Return Value:
+**		The step position, counting up for positive moves and down for negative ones
+**
+**	Errors:
+**		none
+**
+**  Description:
+**		Reads the position, updated as each pulse finishes. Safe to call while moving.
+**
+**	Example:
+**		long pos = stepperPosition(TIMER2);
+*/
+long stepperPosition(uint8_t timerNum){
+	if (timerNum == TIMER2 || timerNum == TIMER3) return stepPosition[timerNum - TIMER2];
+	return 0;
+}
+
+/* --------------------------------------------------------------------------------------------------------------------------------------- */
+/*	stepperRunning()
+**
+**	Parameters:
+**		timerNum:	The axis to check <TIMER2, TIMER3>
+**
+**	Return Value:
+**		true while a move is in progress
+**
+**	Errors:
+**		none
+**
+**	Example:
+**		while (stepperRunning(TIMER2));	Waits for the move to finish
+*/
+bool stepperRunning(uint8_t timerNum){
+	if (timerNum == TIMER2 || timerNum == TIMER3) return stepPhase[timerNum - TIMER2] != STEP_IDLE;
+	return false;
+}
+
+/* --------------------------------------------------------------------------------------------------------------------------------------- */
+//Cyclic executive tick, attached through intFunc[] by startExecutive(). Runs one minor frame's tasks in table order,
+//timing each rate group with the core timer.
+static void executiveTick(void){
+
+	uint32_t spent[EXEC_MAX_GROUPS];
+	uint32_t start, end;
+	uint32_t tick = timerIFMask[timerSlot(execTimer)];
+	uint8_t frame = execFrame;
+	uint8_t i, g, task;
+	bool ran[EXEC_MAX_GROUPS];
+	bool overran = false;
+
+	for (g = 0; g < execGroups; g++) spent[g] = 0, ran[g] = false;
+
+	for (i = execFrameStart[frame]; i < execFrameStart[frame+1]; i++){
+		task = execSlots[i];
+		g = execTaskGroup[task];
+		start = _CP0_GET_COUNT();
+		(*execTasks[task].task)();
+		end = _CP0_GET_COUNT();
+		spent[g] += (end - start) * 2;	//Core timer counts at half the CPU clock
+		ran[g] = true;
+
+		//The flag was cleared on entry, so if it is set again the frame ran into the next tick. Only the group
+		//whose task was running when that happened is charged.
+		if (!overran && (IFS0 & tick)) execGroupOverruns[g]++, overran = true;
+	}
+
+	for (g = 0; g < execGroups; g++){
+		if (ran[g] && spent[g] > execGroupWorst[g]) execGroupWorst[g] = spent[g];
+	}
+
+	execFrame = (frame+1 == execFrames) ? 0 : frame+1;
+}
+
+static uint8_t executiveGroup(uint16_t rate){
+	uint8_t g;
+
+	for (g = 0; g < execGroups; g++){
+		if (execGroupRate[g] == rate) return g;
+	}
+	return 0xFF;
+}
+
+/* --------------------------------------------------------------------------------------------------------------------------------------- */
+/*	startExecutive()
+**
+**	Parameters:
+**		timerNum:	The base timer <TIMER1, TIMER2, TIMER3, TIMER4, TIMER5, TIMER23, TIMER45>
+**		tasks:		Constant table of {task, rate} entries. It must stay valid while the executive runs.
+**		numTasks:	Number of entries in the table
+**
+**	Return Value:
+**		true if the schedule was built and the executive started
+**
+**	Errors:
+**		Returns false, with the executive stopped, if a rate does not divide the fastest rate, or the table is bigger
+**		than EXEC_MAX_TASKS, EXEC_MAX_GROUPS, EXEC_MAX_FRAMES or EXEC_MAX_SLOTS allow.
+**
+**  Description:
+**		Runs a table of periodic tasks from one timer interrupt. The timer ticks at the fastest rate in the table
+**		(the minor frame). A task at rate r runs every fastest/r minor frames, and the schedule repeats every major
+**		frame (the least common multiple of those divisors). All tasks run to completion in the tick interrupt,
+**		in table order, so they never preempt each other.
+**
+**		The schedule is worked out once, here. Faster tasks are placed first. Each slower task is then given the
+**		offset into its period that adds it to the least loaded minor frames, so, for example, ten 10 Hz tasks
+**		on a 1 kHz base land in ten different frames instead of all in frame 0.
+**
+**		Tasks with the same rate form a rate group. For each group, executiveWorstCycles() gives the longest time
+**		its tasks took in one frame, and executiveOverruns() counts the frames that went past the next tick while
+**		one of its tasks was running.
+**		The tick is set in whole microseconds, so a fastest rate that doesn't divide 1000000 is rounded.
+**
+**	Example:
+**		const ExecTask tasks[] = {{control, 1000}, {filter, 100}, {display, 10}};
+**		startExecutive(TIMER1, tasks, 3);
+*/
+bool startExecutive(uint8_t timerNum, const ExecTask *tasks, uint8_t numTasks){
+
+	uint8_t load[EXEC_MAX_FRAMES];
+	uint8_t phase[EXEC_MAX_TASKS];
+	uint16_t divisor[EXEC_MAX_TASKS];
+	uint16_t base = 0, frames = 1, a, b, d, p, f, best, bestLoad, worst;
+	uint16_t slots = 0;
+	uint8_t i, j, g;
+
+	stopExecutive();
+	if (timerNum >= 7 || numTasks == 0 || numTasks > EXEC_MAX_TASKS) return false;
+	for (i = 0; i < numTasks; i++){
+		if (tasks[i].rate == 0 || tasks[i].task == 0) return false;
+		if (tasks[i].rate > base) base = tasks[i].rate;
+	}
+
+	//Divisors, rate groups and the major frame length
+	execGroups = 0;
+	for (i = 0; i < numTasks; i++){
+		if (base % tasks[i].rate) return false;
+		divisor[i] = base / tasks[i].rate;
+		a = frames, b = divisor[i];
+		while (b) d = a % b, a = b, b = d;		//a = gcd(frames, divisor)
+		if ((uint32_t)frames / a * divisor[i] > EXEC_MAX_FRAMES) return false;
+		frames = frames / a * divisor[i];
+
+		g = executiveGroup(tasks[i].rate);
+		if (g == 0xFF){
+			if (execGroups == EXEC_MAX_GROUPS) return false;
+			g = execGroups++;
+			execGroupRate[g] = tasks[i].rate;
+		}
+		execTaskGroup[i] = g;
+	}
+
+	//Offsets: fastest tasks first, each slower one into the frames that are least loaded so far
+	for (f = 0; f < frames; f++) load[f] = 0;
+	for (d = 1; d <= frames; d++){
+		for (i = 0; i < numTasks; i++){
+			if (divisor[i] != d) continue;
+			best = 0, bestLoad = 0xFFFF;
+			for (p = 0; p < d; p++){
+				worst = 0;
+				for (f = p; f < frames; f += d) if (load[f] > worst) worst = load[f];
+				if (worst < bestLoad) best = p, bestLoad = worst;
+			}
+			phase[i] = best;
+			for (f = best; f < frames; f += d) load[f]++;
+			slots += frames / d;
+			if (slots > EXEC_MAX_SLOTS) return false;
+		}
+	}
+
+	//Flatten into per-frame slot lists, in table order
+	slots = 0;
+	for (f = 0; f < frames; f++){
+		execFrameStart[f] = slots;
+		for (j = 0; j < numTasks; j++){
+			if (f % divisor[j] == phase[j]) execSlots[slots++] = j;
+		}
+	}
+	execFrameStart[frames] = slots;
+
+	execTasks = tasks;
+	execFrames = frames;
+	execFrame = 0;
+	execTimer = timerNum;
+	resetExecutiveStats();
+
+	startTimer(timerNum, 1000000L / base);
+	attachTimerInterrupt(timerNum, executiveTick);
+	return true;
+}
+
+/* --------------------------------------------------------------------------------------------------------------------------------------- */
+/*	stopExecutive()
+**
+**	Parameters:
+**		none
+**
+**	Return Value:
+**		none
+**
+**	Errors:
+**		none
+**
+**  Description:
+**		Stops the base timer and detaches the executive. The statistics are kept.
+**
+**	Example:
+**		stopExecutive();
+*/
+void stopExecutive(void){
+	if (execTimer < 7){
+		stopTimer(execTimer);
+		detachTimerInterrupt(execTimer);
+		execTimer = 0xFF;
+	}
+}
+
+/* --------------------------------------------------------------------------------------------------------------------------------------- */
+/*	executiveOverruns()
+**
+**	Parameters:
+**		rate:	The rate group to read
+**
+**	Return Value:
+**		The number of frames where the next tick came during one of the group's tasks, or 0 for an unknown rate
+**
+**	Errors:
+**		none
+**
+**	Example:
+**		if (executiveOverruns(1000)) digitalWrite(LED, HIGH);
+*/
+uint32_t executiveOverruns(uint16_t rate){
+	uint8_t g = executiveGroup(rate);
+	return (g == 0xFF) ? 0 : execGroupOverruns[g];
+}
+
+/* --------------------------------------------------------------------------------------------------------------------------------------- */
+/*	executiveWorstCycles()
+**
+**	Parameters:
+**		rate:	The rate group to read
+**
+**	Return Value:
+**		The longest time, in CPU cycles, the group's tasks have taken in one frame, or 0 for an unknown rate
+**
+**	Errors:
+**		none
+**
+**  Description:
+**		Measured with the core timer, so it has 2 cycle resolution. Time spent in higher priority interrupts
+**		that preempt a task is included.
+**
+**	Example:
+**		Serial.println(executiveWorstCycles(100));
+*/
+uint32_t executiveWorstCycles(uint16_t rate){
+	uint8_t g = executiveGroup(rate);
+	return (g == 0xFF) ? 0 : execGroupWorst[g];
+}
+
+/* --------------------------------------------------------------------------------------------------------------------------------------- */
+/*	resetExecutiveStats()
+**
+**	Parameters:
+**		none
+**
+**	Return Value:
+**		none
+**
+**	Errors:
+**		none
+**
+**  Description:
+**		Clears the overrun counts and worst case times of every rate group.
+**
+**	Example:
+**		resetExecutiveStats();
+*/
+void resetExecutiveStats(void){
+	uint8_t g;
+
+	for (g = 0; g < execGroups; g++) execGroupOverruns[g] = 0, execGroupWorst[g] = 0;
+}
+
+/* --------------------------------------------------------------------------------------------------------------------------------------- */
+//Register tables for applyProfile(), indexed TIMER1-TIMER5 and OC1-OC5 (from 0)
+static volatile unsigned int * const timerConReg[5] = {&T1CON, &T2CON, &T3CON, &T4CON, &T5CON};
+static volatile unsigned int * const timerPRReg[5] = {&PR1, &PR2, &PR3, &PR4, &PR5};
+static volatile unsigned int * const timerTMRReg[5] = {&TMR1, &TMR2, &TMR3, &TMR4, &TMR5};
+static volatile unsigned int * const ocConReg[5] = {&OC1CON, &OC2CON, &OC3CON, &OC4CON, &OC5CON};
+static volatile unsigned int * const ocRReg[5] = {&OC1R, &OC2R, &OC3R, &OC4R, &OC5R};
+static volatile unsigned int * const ocRSReg[5] = {&OC1RS, &OC2RS, &OC3RS, &OC4RS, &OC5RS};
+
+/* --------------------------------------------------------------------------------------------------------------------------------------- */
+/*	captureProfile()
+**
+**	Parameters:
+**		profile:	Where to store the current setup
+**
+**	Return Value:
+**		none
+**
+**	Errors:
+**		none
+**
+**  Description:
+**		Records the current timer, output compare and timer interrupt setup, so it can be put back later with
+**		applyProfile(). Set each operating mode up once at startup with the usual calls (startTimer(), startPWM(),
+**		attachTimerInterrupt(), ...), capture it, and switch between the captured profiles from then on. Profiles
+**		are plain register values, so they can also be written out as const data.
+**
+**	Example:
+**		TimerProfile highRate;
+**		startTimer(TIMER3, 100); startPWM(TIMER3, OC1, 50); attachTimerInterrupt(TIMER3, sample);
+**		captureProfile(&highRate);
+*/
+void captureProfile(TimerProfile *profile){
+
+	uint8_t i;
+
+	for (i = 0; i < 5; i++){
+		profile->timerCon[i] = *timerConReg[i];
+		profile->timerPR[i] = *timerPRReg[i];
+		profile->ocCon[i] = *ocConReg[i];
+		profile->ocR[i] = *ocRReg[i];
+		profile->ocRS[i] = *ocRSReg[i];
+		profile->intFunc[i] = intFunc[i];
+	}
+	profile->intEnable = IEC0 & TIMER_ALL_INT;
+}
+
+/* --------------------------------------------------------------------------------------------------------------------------------------- */
+/*	applyProfile()
+**
+**	Parameters:
+**		profile:	The setup to switch to
+**
+**	Return Value:
+**		none
+**
+**	Errors:
+**		none
+**
+**  Description:
+**		Switches to a captured setup, writing only the registers that differ. Interrupts are turned off, everything
+**		that changes is worked out from the live registers, and then:
+**			1. interrupts of timers that change or go away are disabled
+**			2. output compare modules that change or turn off are stopped, before their timer
+**			3. timers that change or turn off are stopped, and changed timers are reloaded with TMRx = 0
+**			4. output compare modules are rewritten while their timer is stopped, so their first period is whole
+**			5. callbacks are swapped
+**			6. timers that should run are started together with back to back TxCONSET stores
+**			7. the profile's interrupts are enabled
+**		Outputs whose timer and module don't change keep running untouched. A duty cycle change on an otherwise
+**		unchanged PWM is a single OCxRS write, which the hardware picks up at the next period.
+**
+**	Example:
+**		applyProfile(&highRate);
+*/
+void applyProfile(const TimerProfile *profile){
+
+	uint32_t timerStart[5], ocStop = 0, ocWrite = 0, ocDuty = 0, timerStop = 0, timerLoad = 0, ieOff, status;
+	uint8_t i;
+	bool pwm;
+
+	//Work out the delta with interrupts already off, so an ISR rewriting PRx or OCxRS (setDutyCycle(), the stepper,
+	//extended periods) can't change the registers between the compare and the write
+	status = disableInterrupts();
+	for (i = 0; i < 5; i++){
+		timerStart[i] = profile->timerCon[i] & T_ON;
+		if (((*timerConReg[i] ^ profile->timerCon[i]) & ~T_ON) || *timerPRReg[i] != profile->timerPR[i])
+			timerLoad |= 1 << i;
+		if ((timerLoad & (1 << i)) || !timerStart[i]) timerStop |= 1 << i;
+		else if (*timerConReg[i] & T_ON) timerStart[i] = 0;	//Running already and unchanged
+
+		//In PWM mode OCxR is reloaded from OCxRS by the hardware, so only OCxRS matters
+		pwm = (profile->ocCon[i] & _OC1CON_OCM_MASK) >= OC_PWM_FAULT_PIN_DISABLE;
+		if (*ocConReg[i] != profile->ocCon[i] || (!pwm && *ocRReg[i] != profile->ocR[i])){
+			ocStop |= 1 << i;
+			ocWrite |= 1 << i;
+		}
+		else if (*ocRSReg[i] != profile->ocRS[i]) ocDuty |= 1 << i;
+	}
+	//Output compare modules follow their timer. 32 bit mode runs from TIMER2.
+	for (i = 0; i < 5; i++){
+		if (!(profile->ocCon[i] & OC_ON)) continue;
+		if ((profile->ocCon[i] & OC_TIMER_MODE32) ? (timerLoad & (1 << TIMER2)) :
+			(timerLoad & (1 << ((profile->ocCon[i] & OC_TIMER3_SRC) ? TIMER3 : TIMER2)))){
+			ocStop |= 1 << i;
+			ocWrite |= 1 << i;
+			ocDuty &= ~(1 << i);
+		}
+	}
+	ieOff = (IEC0 & TIMER_ALL_INT) & ~profile->intEnable;
+	for (i = 0; i < 5; i++) if (timerLoad & (1 << i)) ieOff |= timerIEMask[i];
+
+	IEC0CLR = ieOff;
+	for (i = 0; i < 5; i++) if (ocStop & (1 << i)) *ocConReg[i] = 0;
+	T1CONCLR = (timerStop & (1 << TIMER1)) ? T_ON : 0;
+	T2CONCLR = (timerStop & (1 << TIMER2)) ? T_ON : 0;
+	T3CONCLR = (timerStop & (1 << TIMER3)) ? T_ON : 0;
+	T4CONCLR = (timerStop & (1 << TIMER4)) ? T_ON : 0;
+	T5CONCLR = (timerStop & (1 << TIMER5)) ? T_ON : 0;
+
+	for (i = 0; i < 5; i++){
+		if (timerLoad & (1 << i)){
+			*timerConReg[i] = profile->timerCon[i] & ~T_ON;
+			*timerPRReg[i] = profile->timerPR[i];
+			*timerTMRReg[i] = 0;
+		}
+	}
+	for (i = 0; i < 5; i++){
+		if (ocWrite & (1 << i)){
+			*ocRReg[i] = profile->ocR[i];
+			*ocRSReg[i] = profile->ocRS[i];
+			*ocConReg[i] = profile->ocCon[i];
+		}
+		else if (ocDuty & (1 << i)) *ocRSReg[i] = profile->ocRS[i];
+	}
+
+	for (i = 0; i < 5; i++){
+		if (profile->intFunc[i] != 0 && intFunc[i] == 0) setTimerVector(i, timerHandlers[i]);
+		intFunc[i] = profile->intFunc[i];
+	}
+
+	T1CONSET = timerStart[TIMER1];
+	T2CONSET = timerStart[TIMER2];
+	T3CONSET = timerStart[TIMER3];
+	T4CONSET = timerStart[TIMER4];
+	T5CONSET = timerStart[TIMER5];
+
+	IFS0CLR = profile->intEnable & ~(IEC0 & TIMER_ALL_INT);		//Drop flags left over from the old setup
+	IEC0SET = profile->intEnable;
+
+	restoreInterrupts(status);
+}
+
 
 //Interrupt Service Routines
+//The flag is cleared before calling the user function, so a period that ends during the call is not lost. The
+//event counter binds its own handlers instead, see counterISR().
 //************************************************************************
 // Timer1 ISR
 void __attribute__((interrupt(),nomips16)) Timer1IntHandler(void)
 {
+	voidFuncPtr func = intFunc[TIMER1];
 
-	if (intFunc[TIMER1] != 0)
+	IFS0CLR = _IFS0_T1IF_MASK;
+	if (func != 0)
 	{
-		(*intFunc[TIMER1])();
+		(*func)();
 	}
-	IFS0bits.T1IF	=	0;
 }
 
 //************************************************************************
 // Timer2 ISR
 void __attribute__((interrupt(),nomips16)) Timer2IntHandler(void)
 {
+	voidFuncPtr func = intFunc[TIMER2];
 
-	if (intFunc[TIMER2] != 0)
+	IFS0CLR = _IFS0_T2IF_MASK;
+	if (func != 0)
 	{
-		(*intFunc[TIMER2])();
+		(*func)();
 	}
-	IFS0bits.T2IF	=	0;
 }
 
 //************************************************************************
 // Timer3 ISR
 void __attribute__((interrupt(),nomips16)) Timer3IntHandler(void)
 {
+	voidFuncPtr func = intFunc[TIMER3];
 
-	if (intFunc[TIMER3] != 0)
+	IFS0CLR = _IFS0_T3IF_MASK;
+	if (func != 0)
 	{
-		(*intFunc[TIMER3])();
+		(*func)();
 	}
-	IFS0bits.T3IF	=	0;
 }
 
 //************************************************************************
 // Timer4 ISR
 void __attribute__((interrupt(),nomips16))Timer4IntHandler(void)
 {
+	voidFuncPtr func = intFunc[TIMER4];
 
-	if (intFunc[TIMER4] != 0)
+	IFS0CLR = _IFS0_T4IF_MASK;
+	if (func != 0)
 	{
-		(*intFunc[TIMER4])();
+		(*func)();
 	}
-	IFS0bits.T4IF	=	0;
 }
 
 //************************************************************************
 // Timer5 ISR
 void __attribute__((interrupt(),nomips16)) Timer5IntHandler(void)
 {
+	voidFuncPtr func = intFunc[TIMER5];
 
-	if (intFunc[TIMER5] != 0)
+	IFS0CLR = _IFS0_T5IF_MASK;
+	if (func != 0)
 	{
-		(*intFunc[TIMER5])();
+		(*func)();
 	}
-	IFS0bits.T5IF	=	0;
 }
 
 //************************************************************************
@@ -64,6 +64,26 @@
 #define TIMER5	4
 #define TIMER23	5
 #define TIMER45	6
+#define TIMERCORE	7	/* CP0 core timer, see startTimer() */
+
+//Interrupt flag for a timer, folded to a constant when timerNum is. 0 for TIMERCORE, which has no flag in IFS0.
+#define TIMER_IF_MASK(timerNum)	((timerNum)==TIMER1 ? _IFS0_T1IF_MASK : (timerNum)==TIMER2 ? _IFS0_T2IF_MASK : \
+								 (timerNum)==TIMER3 || (timerNum)==TIMER23 ? _IFS0_T3IF_MASK : \
+								 (timerNum)==TIMER4 ? _IFS0_T4IF_MASK : \
+								 (timerNum)==TIMER5 || (timerNum)==TIMER45 ? _IFS0_T5IF_MASK : 0)
+
+//Timer sets for startTimerGroup()/stopTimerGroup()
+#define TIMER_BIT(timerNum)	(1 << (timerNum))
+
+//Interrupt masks for enableTimerInterrupts()/disableTimerInterrupts(). 32 bit timers interrupt on the odd timer.
+#define TIMER1_INT	_IEC0_T1IE_MASK
+#define TIMER2_INT	_IEC0_T2IE_MASK
+#define TIMER3_INT	_IEC0_T3IE_MASK
+#define TIMER4_INT	_IEC0_T4IE_MASK
+#define TIMER5_INT	_IEC0_T5IE_MASK
+#define TIMER23_INT	_IEC0_T3IE_MASK
+#define TIMER45_INT	_IEC0_T5IE_MASK
+#define TIMER_ALL_INT	(TIMER1_INT | TIMER2_INT | TIMER3_INT | TIMER4_INT | TIMER5_INT)
 
 //Symbols for output compare modules
 #define OC1	1
@@ -101,19 +121,64 @@
 #define OC_LOW_HIGH                 (1 << _OC1CON_OCM_POSITION)     /* Compare1 forces OCx pin High*/
 #define OC_MODE_OFF                 (0 << _OC1CON_OCM_POSITION)     /* OutputCompare x Off*/
 
-#define PS_1_256 0x7 << _T1CON_TCKPS_POSITION
-#define PS_1_64	 0x6 << _T1CON_TCKPS_POSITION
-#define PS_1_32	 0x5 << _T1CON_TCKPS_POSITION
-#define PS_1_16	 0x4 << _T1CON_TCKPS_POSITION
-#define PS_1_8	 0x3 << _T1CON_TCKPS_POSITION
-#define PS_1_4	 0x2 << _T1CON_TCKPS_POSITION
-#define PS_1_2	 0x1 << _T1CON_TCKPS_POSITION
-#define PS_1_1	 0x0 << _T1CON_TCKPS_POSITION
+//Stepper acceleration profiles for moveStepper()
+#define STEPPER_TRAPEZOID	0
+#define STEPPER_SCURVE		1
+
+#define STEPPER_PULSE_US		3		/* STEP pulse width */
+#define STEPPER_MIN_PERIOD_US	10		/* Shortest step period, 100 kHz */
+
+//Cyclic executive limits. These size the library's static tables, so changing them means editing them here.
+#define EXEC_MAX_TASKS		16		/* Entries in the task table */
+#define EXEC_MAX_GROUPS		8		/* Distinct rates */
+#define EXEC_MAX_FRAMES		200		/* Minor frames in the major frame (fastest rate / slowest rate) */
+#define EXEC_MAX_SLOTS		255		/* Task runs in one major frame */
+
+#define PS_1_256 (0x7 << _T1CON_TCKPS_POSITION)
+#define PS_1_64	 (0x6 << _T1CON_TCKPS_POSITION)
+#define PS_1_32	 (0x5 << _T1CON_TCKPS_POSITION)
+#define PS_1_16	 (0x4 << _T1CON_TCKPS_POSITION)
+#define PS_1_8	 (0x3 << _T1CON_TCKPS_POSITION)
+#define PS_1_4	 (0x2 << _T1CON_TCKPS_POSITION)
+#define PS_1_2	 (0x1 << _T1CON_TCKPS_POSITION)
+#define PS_1_1	 (0x0 << _T1CON_TCKPS_POSITION)
+
+//Timer1 has its own prescaler encoding
+#define T1_PS_1_256	(0x3 << _T1CON_TCKPS_POSITION)
+#define T1_PS_1_64	(0x2 << _T1CON_TCKPS_POSITION)
+#define T1_PS_1_8	(0x1 << _T1CON_TCKPS_POSITION)
+#define T1_PS_1_1	(0x0 << _T1CON_TCKPS_POSITION)
+
+#define T_32_BIT_MODE_ON	(0x1 << _T2CON_T32_POSITION)
 
-#define T_32_BIT_MODE_ON	0x1 << _T2CON_T32_POSITION
+#define T_ON	(1<< _T1CON_ON_POSITION)
 
-#define T_ON	1<< _T1CON_ON_POSITION
+#define T_SOURCE_EXT	(1 << _T1CON_TCS_POSITION)		/* Count rising edges on the TxCK pin */
+#define T_SYNC_EXT_ON	(1 << _T1CON_TSYNC_POSITION)		/* Synchronize TxCK to PBCLK (Timer1 only) */
+#define T_GATE_ON		(1 << _T1CON_TGATE_POSITION)		/* Count PBCLK only while TxCK is high */
 
+//Counter modes for startCounter()
+#define COUNT_EXTERNAL		0	/* Count TxCK edges. Timer1 counts asynchronously, the others are always synchronized */
+#define COUNT_EXTERNAL_SYNC	1	/* Count TxCK edges synchronized to PBCLK */
+#define COUNT_GATED			2	/* Accumulate PBCLK cycles while TxCK is high */
+
+
+//One entry in a cyclic executive task table
+typedef struct {
+	void (*task)(void);
+	uint16_t rate;		//Runs per second. Must divide the fastest rate in the table.
+} ExecTask;
+
+//A complete timer, output compare and timer interrupt setup, for applyProfile()
+typedef struct {
+	uint32_t timerCon[5];		//TxCON, including ON, for TIMER1-TIMER5
+	uint32_t timerPR[5];
+	uint32_t ocCon[5];			//OCxCON, including ON, for OC1-OC5
+	uint32_t ocR[5];
+	uint32_t ocRS[5];
+	uint32_t intEnable;			//Enabled timer interrupts <TIMER1_INT ... TIMER5_INT>
+	voidFuncPtr intFunc[5];		//Attached functions, by interrupt (TIMER1-TIMER5)
+} TimerProfile;
 
 // forward references to the ISRs
 void __attribute__((interrupt(),nomips16)) Timer1IntHandler(void);
@@ -124,19 +189,80 @@ void __attribute__((interrupt(),nomips16)) Timer5IntHandler(void);
 
 //Forward references to library functions
 void startTimer(uint8_t timerNum, long microseconds);
+void startTimerExtended(uint8_t timerNum, uint64_t microseconds, void (*userFunc)(void));
 void stopTimer(uint8_t timerNum);
 void setTimerPeriod(uint8_t timerNum, long microseconds);
 void timerReset(uint8_t timerNum);
+void startTimerOneShot(uint8_t timerNum, long microseconds);
+uint32_t coreCycles(void);
+void prepareTimer(uint8_t timerNum, long microseconds, long phase);
+uint32_t startTimerGroup(uint8_t timers);
+void stopTimerGroup(uint8_t timers);
 void attachTimerInterrupt(uint8_t timerNum, void (*userFunc)(void));
 void detachTimerInterrupt(uint8_t timerNum);
 void disableTimerInterrupt(uint8_t timerNum);
 void enableTimerInterrupt(uint8_t timerNum);
+void disableTimerInterrupts(uint32_t mask);
+void enableTimerInterrupts(uint32_t mask);
+void bindTimerVector(uint8_t timerNum, isrFunc handler);
 
 void startPWM(uint8_t timerNum, uint8_t OCnum, uint8_t dutycycle);
 void stopPWM(uint8_t OCnum);
 void setDutyCycle(uint8_t OCnum, float dutycycle);
 
+void startCounter(uint8_t timerNum, uint8_t mode, uint16_t prescale);
+void stopCounter(uint8_t timerNum);
+void resetCounter(uint8_t timerNum);
+uint32_t readCounter(uint8_t timerNum);
+uint64_t readCounter64(uint8_t timerNum);
+void setCounterThreshold(uint8_t timerNum, uint64_t count, void (*userFunc)(void));
+
+void setupStepper(uint8_t timerNum, uint8_t OCnum, uint8_t dirPin);
+void moveStepper(uint8_t timerNum, long steps, uint32_t maxSpeed, uint32_t accel, uint8_t profile);
+void stopStepper(uint8_t timerNum);
+void haltStepper(uint8_t timerNum);
+long stepperPosition(uint8_t timerNum);
+bool stepperRunning(uint8_t timerNum);
+
+bool startExecutive(uint8_t timerNum, const ExecTask *tasks, uint8_t numTasks);
+void stopExecutive(void);
+uint32_t executiveOverruns(uint16_t rate);
+uint32_t executiveWorstCycles(uint16_t rate);
+void resetExecutiveStats(void);
+
+void captureProfile(TimerProfile *profile);
+void applyProfile(const TimerProfile *profile);
+
+/*	bindTimerISR<timerNum, userFunc>()
+**
+**	Binds userFunc to a timer at compile time. A dedicated handler is generated for the pair that clears TxIF with
+**	one IFS0CLR store and calls userFunc directly, so small handlers get inlined. Compared with
+**	attachTimerInterrupt(), this skips the volatile intFunc[] load, the null check and the indirect call. Because
+**	the library handler calls an unknown function, its prologue and epilogue also have to save and restore every
+**	caller-saved register (at, v0-v1, a0-a3, t0-t9, ra, hi, lo), one store and one load each. A bound handler
+**	whose body is inlined only saves the registers it uses, so the saving grows as the handler gets smaller. The
+**	exact figure depends on the compiler version and options; run the BoundTimerISR example to measure both
+**	paths on the board.
+**
+**	attachTimerInterrupt() is still the way to change handlers at run time. TIMERCORE can't be bound, since the
+**	core timer's vector is shared with millis(); use attachTimerInterrupt() for it.
+**
+**	Example:
+**		bindTimerISR<TIMER3, toggleLED>();
+*/
+template <uint8_t timerNum, void (*userFunc)(void)>
+void __attribute__((interrupt(),nomips16)) boundTimerIntHandler(void)
+{
+	IFS0CLR = TIMER_IF_MASK(timerNum);
+	userFunc();
+}
 
+template <uint8_t timerNum, void (*userFunc)(void)>
+inline void bindTimerISR(void)
+{
+	typedef char onlyTIMER1toTIMER45[(timerNum < 7) ? 1 : -1] __attribute__((unused));	//Fails to compile for TIMERCORE
+	bindTimerVector(timerNum, (isrFunc) boundTimerIntHandler<timerNum, userFunc>);
+}
 
 
 #endif
@@ -0,0 +1,73 @@
+/**************************************************/
+/* SimpleTimer Bound ISR Timing                   */
+/**************************************************/
+/*                                                */
+/*   Made for use with chipKIT Uno32              */
+/*                                                */
+/**************************************************/
+/*  Module Description:                           */
+/*                                                */
+/*    Compares the interrupt latency of a         */
+/*    handler attached at run time with           */
+/*    attachTimerInterrupt() against the same     */
+/*    handler bound at compile time with          */
+/*    bindTimerISR<>().                           */
+/*                                                */
+/*  Functionality:                                */
+/*                                                */
+/*    TIMER3's interrupt is triggered from        */
+/*    software and timed with the core timer.     */
+/*    "entry" is the time from setting T3IF to    */
+/*    the first line of the handler, "total" is   */
+/*    the time until the interrupt has returned.  */
+/*    Both include one peripheral bus read of     */
+/*    IFS0, which is the same for each path.      */
+/*    Results are printed in CPU cycles.          */
+/*                                                */
+/**************************************************/
+
+#include <SimpleTimers.h>
+
+#define RUNS 100
+
+volatile unsigned long entered;
+
+void markEntry(){
+  entered = _CP0_GET_COUNT();
+}
+
+//Triggers TIMER3's interrupt RUNS times and prints the best case entry and total times
+void measure(const char *name){
+  unsigned long start, done, entry = 0xFFFFFFFF, total = 0xFFFFFFFF;
+
+  for (int i = 0; i < RUNS; i++){
+    start = _CP0_GET_COUNT();
+    IFS0SET = TIMER_IF_MASK(TIMER3);
+    while (IFS0 & TIMER_IF_MASK(TIMER3));  //The set is posted, so wait until the handler has run and cleared it
+    done = _CP0_GET_COUNT();
+    if ((entered - start) < entry) entry = entered - start;
+    if ((done - start) < total) total = done - start;
+  }
+  Serial.print(name);
+  Serial.print(" entry: ");
+  Serial.print(entry * 2);  //Core timer counts at half the CPU clock
+  Serial.print(" cycles, total: ");
+  Serial.print(total * 2);
+  Serial.println(" cycles");
+}
+
+void setup() {
+  Serial.begin(9600);
+  stopTimer(TIMER3);  //Only the software trigger should fire the interrupt
+
+  attachTimerInterrupt(TIMER3, markEntry);
+  measure("attachTimerInterrupt");
+
+  bindTimerISR<TIMER3, markEntry>();
+  measure("bindTimerISR        ");
+
+  detachTimerInterrupt(TIMER3);
+}
+
+void loop() {
+}